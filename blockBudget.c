@@ -0,0 +1,173 @@
+#ifndef _BLOCKBUDGET_INCLUDED
+#define _BLOCKBUDGET_INCLUDED
+/* blockBudget
+
+   Per block readout time budget.  Each block that takes longer than the
+   budget in rocTrigger is an overrun.  Overruns are counted by the phase
+   that took the most time (see TRIGGER_PHASE_* in tsTrigger.c) and by
+   whether the block was a sync event.  The BLOCKBUDGET_WORST slowest
+   blocks are kept, with their phase times and the first words of their
+   trigger bank.
+
+   void blockBudgetReset(unsigned int budget_ns)  - clear (Prestart)
+   void blockBudgetBlock(ns, evntno, block, nwords)
+                                  - account one block, with the phase
+                                    times left in tsTriggerPhaseNs[]
+   unsigned int blockBudgetOverruns()
+                                  - total overruns
+   void blockBudgetPrint()        - print the summary (remex)
+   int  blockBudgetWrite(char *fname)
+                                  - write the summary as text
+*/
+
+#define BLOCKBUDGET_WORST     16
+#define BLOCKBUDGET_HDRWORDS  8
+
+typedef struct
+{
+  unsigned int ns;
+  int evntno;
+  int sync;
+  unsigned int phaseNs[TRIGGER_NPHASES];
+  int nwords;
+  unsigned int header[BLOCKBUDGET_HDRWORDS];
+} BLOCKBUDGET_BLOCK;
+
+unsigned int budgetNs = 0;
+unsigned int budgetBlocks[2];                       /* [sync] */
+unsigned int budgetOverruns[TRIGGER_NPHASES][2];    /* [phase][sync] */
+BLOCKBUDGET_BLOCK budgetWorst[BLOCKBUDGET_WORST];
+int budgetNworst = 0;
+
+void
+blockBudgetReset(unsigned int budget_ns)
+{
+  budgetNs = budget_ns;
+  memset(budgetBlocks, 0, sizeof(budgetBlocks));
+  memset(budgetOverruns, 0, sizeof(budgetOverruns));
+  memset(budgetWorst, 0, sizeof(budgetWorst));
+  budgetNworst = 0;
+}
+
+void
+blockBudgetBlock(unsigned int ns, int evntno, volatile unsigned int *block,
+		 int nwords)
+{
+  BLOCKBUDGET_BLOCK *slot;
+  int sync = tsTriggerLastSync ? 1 : 0, iphase, phase = 0, iworst;
+
+  budgetBlocks[sync]++;
+
+  if(ns <= budgetNs)
+    return;
+
+  for(iphase = 1; iphase < TRIGGER_NPHASES; iphase++)
+    if(tsTriggerPhaseNs[iphase] > tsTriggerPhaseNs[phase])
+      phase = iphase;
+  budgetOverruns[phase][sync]++;
+
+  /* Keep it if it's slower than the fastest of the worst */
+  if(budgetNworst < BLOCKBUDGET_WORST)
+    {
+      slot = &budgetWorst[budgetNworst++];
+    }
+  else
+    {
+      slot = &budgetWorst[0];
+      for(iworst = 1; iworst < BLOCKBUDGET_WORST; iworst++)
+	if(budgetWorst[iworst].ns < slot->ns)
+	  slot = &budgetWorst[iworst];
+      if(ns <= slot->ns)
+	return;
+    }
+
+  slot->ns = ns;
+  slot->evntno = evntno;
+  slot->sync = sync;
+  memcpy(slot->phaseNs, tsTriggerPhaseNs, sizeof(slot->phaseNs));
+  slot->nwords = (nwords < BLOCKBUDGET_HDRWORDS) ? nwords : BLOCKBUDGET_HDRWORDS;
+  if(slot->nwords > 0)
+    memcpy(slot->header, (void *)block, slot->nwords*4);
+}
+
+unsigned int
+blockBudgetOverruns()
+{
+  unsigned int total = 0;
+  int iphase;
+
+  for(iphase = 0; iphase < TRIGGER_NPHASES; iphase++)
+    total += budgetOverruns[iphase][0] + budgetOverruns[iphase][1];
+
+  return total;
+}
+
+int
+blockBudgetCompare(const void *a, const void *b)
+{
+  const BLOCKBUDGET_BLOCK *ba = a, *bb = b;
+
+  return (ba->ns < bb->ns) - (ba->ns > bb->ns);
+}
+
+void
+blockBudgetFprint(FILE *fd)
+{
+  BLOCKBUDGET_BLOCK worst[BLOCKBUDGET_WORST];
+  int iphase, iworst, iword;
+
+  fprintf(fd, "# budget %.1f us  blocks %u (sync %u)\n",
+	  1e-3 * budgetNs, budgetBlocks[0] + budgetBlocks[1], budgetBlocks[1]);
+  fprintf(fd, "# overruns by slowest phase:  phase  normal  sync\n");
+  for(iphase = 0; iphase < TRIGGER_NPHASES; iphase++)
+    fprintf(fd, "#   %-8s %8u %8u\n", tsTriggerPhaseNames[iphase],
+	    budgetOverruns[iphase][0], budgetOverruns[iphase][1]);
+
+  /* Slowest first */
+  memcpy(worst, budgetWorst, sizeof(worst));
+  qsort(worst, budgetNworst, sizeof(BLOCKBUDGET_BLOCK), blockBudgetCompare);
+
+  fprintf(fd, "# block  sync  total_us");
+  for(iphase = 0; iphase < TRIGGER_NPHASES; iphase++)
+    fprintf(fd, "  %s_us", tsTriggerPhaseNames[iphase]);
+  fprintf(fd, "  trigger bank\n");
+
+  for(iworst = 0; iworst < budgetNworst; iworst++)
+    {
+      fprintf(fd, "%7d  %4d  %8.1f", worst[iworst].evntno, worst[iworst].sync,
+	      1e-3 * worst[iworst].ns);
+      for(iphase = 0; iphase < TRIGGER_NPHASES; iphase++)
+	fprintf(fd, "  %*.1f", (int)strlen(tsTriggerPhaseNames[iphase]) + 3,
+		1e-3 * worst[iworst].phaseNs[iphase]);
+      fprintf(fd, " ");
+      for(iword = 0; iword < worst[iworst].nwords; iword++)
+	fprintf(fd, " 0x%08x", worst[iworst].header[iword]);
+      fprintf(fd, "\n");
+    }
+}
+
+void
+blockBudgetPrint()
+{
+  blockBudgetFprint(stdout);
+}
+
+int
+blockBudgetWrite(char *fname)
+{
+  FILE *fd;
+
+  fd = fopen(fname, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return -1;
+    }
+
+  blockBudgetFprint(fd);
+  fclose(fd);
+
+  return 0;
+}
+
+#endif /* _BLOCKBUDGET_INCLUDED */
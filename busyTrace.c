@@ -0,0 +1,238 @@
+#ifndef _BUSYTRACE_INCLUDED
+#define _BUSYTRACE_INCLUDED
+/* busyTrace
+
+   Background sampler of the TS busy status and blocks ready.
+
+   A thread polls the two registers every busyTracePeriod microseconds and
+   stores only the samples where either value changed, stamped with the
+   CPU time stamp counter, in a ring of BUSYTRACE_RING entries.  The
+   sampler is the only writer; busyTraceDump() may be called while it runs
+   and discards any entries overwritten during the copy.
+
+   Periods of BUSYTRACE_SPIN_US and more sleep to each sample time with
+   clock_nanosleep; shorter ones spin on the time stamp counter and take
+   a CPU core for the whole run.  What remains either way: every sample
+   is two VME reads, each taken under the TS library mutex, so a
+   rocTrigger that wants the TS while a sample is in progress waits for
+   it (of order a microsecond per read).  The readout sees at most one
+   such delay per period; keep the period well above it.
+
+   void busyTraceStart(int period_us) - start sampling (call at Go)
+   void busyTraceStop()               - stop sampling (call at End)
+   int  busyTraceDump(char *fname)    - write the ring to fname, see
+                                        busyTrace.h for the format.
+                                        Returns number of entries written.
+
+   Decode the file with busyTraceDecode.
+*/
+#include <stdint.h>
+#include <pthread.h>
+#include "busyTrace.h"
+
+#define BUSYTRACE_RING     (1<<20)  /* entries, power of 2 */
+#define BUSYTRACE_SPIN_US  20       /* shorter periods spin, longer sleep */
+
+BUSYTRACE_ENTRY *busyTraceRing = NULL;
+volatile uint64_t busyTraceWrite = 0;  /* next entry to write */
+uint64_t busyTraceTsc0 = 0;
+double busyTraceTscPerUs = 0;
+int busyTracePeriod = 0;
+
+pthread_t busyTraceThread;
+volatile int busyTraceRunning = 0;
+
+static inline uint64_t
+busyTraceTsc()
+{
+  uint32_t lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+/* Time stamp counter ticks per microsecond, measured over 10 ms */
+double
+busyTraceCalibrate()
+{
+  struct timespec t0, t1;
+  uint64_t tsc0, tsc1;
+  double us;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  tsc0 = busyTraceTsc();
+  usleep(10000);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  tsc1 = busyTraceTsc();
+
+  us = 1e6*(t1.tv_sec - t0.tv_sec) + 1e-3*(t1.tv_nsec - t0.tv_nsec);
+
+  return (double)(tsc1 - tsc0) / us;
+}
+
+void *
+busyTraceRun(void *arg)
+{
+  BUSYTRACE_ENTRY *entry;
+  uint32_t busy, bready, lastBusy = 0xffffffff, lastBready = 0xffffffff;
+  uint64_t now, next, step;
+  struct timespec wake, late;
+  int spin = (busyTracePeriod < BUSYTRACE_SPIN_US);
+
+  step = (uint64_t)(busyTracePeriod * busyTraceTscPerUs);
+  next = busyTraceTsc();
+  clock_gettime(CLOCK_MONOTONIC, &wake);
+
+  while(busyTraceRunning)
+    {
+      if(spin)
+	{
+	  /* Spin to the next sample time */
+	  do
+	    {
+	      __asm__ __volatile__ ("pause");
+	      now = busyTraceTsc();
+	    }
+	  while(now < next);
+	  next += step;
+	}
+      else
+	{
+	  /* Sleep to the next sample time; missed ones are skipped, not
+	     caught up in a burst */
+	  wake.tv_nsec += 1000L * busyTracePeriod;
+	  while(wake.tv_nsec >= 1000000000L)
+	    {
+	      wake.tv_nsec -= 1000000000L;
+	      wake.tv_sec++;
+	    }
+	  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+	  now = busyTraceTsc();
+	  clock_gettime(CLOCK_MONOTONIC, &late);
+	  if((late.tv_sec > wake.tv_sec) ||
+	     ((late.tv_sec == wake.tv_sec) &&
+	      (late.tv_nsec - wake.tv_nsec > 1000L * busyTracePeriod)))
+	    wake = late;
+	}
+
+      busy = tsGetBusyStatus(0);
+      bready = tsBReady();
+
+      if((busy == lastBusy) && (bready == lastBready))
+	continue;
+
+      lastBusy = busy;
+      lastBready = bready;
+
+      entry = &busyTraceRing[busyTraceWrite & (BUSYTRACE_RING - 1)];
+      entry->tsc = now;
+      entry->busy = busy;
+      entry->bready = bready;
+
+      /* Publish the entry only after it is complete */
+      __atomic_store_n(&busyTraceWrite, busyTraceWrite + 1, __ATOMIC_RELEASE);
+    }
+
+  return NULL;
+}
+
+void
+busyTraceStart(int period_us)
+{
+  if(period_us <= 0)
+    return;
+
+  if(busyTraceRing == NULL)
+    {
+      busyTraceRing = (BUSYTRACE_ENTRY *)malloc(BUSYTRACE_RING * sizeof(BUSYTRACE_ENTRY));
+      if(busyTraceRing == NULL)
+	{
+	  printf("%s: ERROR allocating trace ring\n", __func__);
+	  return;
+	}
+      busyTraceTscPerUs = busyTraceCalibrate();
+    }
+
+  busyTracePeriod = period_us;
+  busyTraceWrite = 0;
+  busyTraceTsc0 = busyTraceTsc();
+
+  busyTraceRunning = 1;
+  if(pthread_create(&busyTraceThread, NULL, busyTraceRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating sampler thread\n", __func__);
+      busyTraceRunning = 0;
+    }
+}
+
+void
+busyTraceStop()
+{
+  if(busyTraceRunning)
+    {
+      busyTraceRunning = 0;
+      pthread_join(busyTraceThread, NULL);
+    }
+}
+
+int
+busyTraceDump(char *fname)
+{
+  BUSYTRACE_HEADER header;
+  BUSYTRACE_ENTRY *copy;
+  uint64_t first, last, valid;
+  FILE *fd;
+
+  if(busyTraceRing == NULL)
+    return 0;
+
+  /* Copy the ring, then drop whatever the sampler overwrote meanwhile */
+  last = __atomic_load_n(&busyTraceWrite, __ATOMIC_ACQUIRE);
+  first = (last > BUSYTRACE_RING) ? last - BUSYTRACE_RING : 0;
+
+  copy = (BUSYTRACE_ENTRY *)malloc((last - first) * sizeof(BUSYTRACE_ENTRY) + 1);
+  if(copy == NULL)
+    {
+      printf("%s: ERROR allocating copy\n", __func__);
+      return 0;
+    }
+
+  for(valid = first; valid < last; valid++)
+    copy[valid - first] = busyTraceRing[valid & (BUSYTRACE_RING - 1)];
+
+  valid = __atomic_load_n(&busyTraceWrite, __ATOMIC_ACQUIRE);
+  valid = (valid > BUSYTRACE_RING) ? valid - BUSYTRACE_RING : 0;
+  if(valid < first)
+    valid = first;
+  if(valid > last)
+    valid = last;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = BUSYTRACE_MAGIC;
+  header.version = BUSYTRACE_VERSION;
+  header.run = rol->runNumber;
+  header.nentries = last - valid;
+  header.period_us = busyTracePeriod;
+  header.lost = valid;
+  header.tsc0 = busyTraceTsc0;
+  header.tscPerUs = busyTraceTscPerUs;
+
+  fd = fopen(fname, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      free(copy);
+      return 0;
+    }
+
+  fwrite(&header, sizeof(header), 1, fd);
+  fwrite(&copy[valid - first], sizeof(BUSYTRACE_ENTRY), header.nentries, fd);
+  fclose(fd);
+  free(copy);
+
+  printf("%s: Wrote %d busy transitions to %s\n",
+	 __func__, header.nentries, fname);
+
+  return header.nentries;
+}
+
+#endif /* _BUSYTRACE_INCLUDED */
@@ -0,0 +1,36 @@
+#ifndef _BUSYTRACE_H_INCLUDED
+#define _BUSYTRACE_H_INCLUDED
+/* busyTrace.h
+
+   File format of the TS busy transition trace written by busyTrace.c and
+   read by busyTraceDecode.
+
+   The file is one BUSYTRACE_HEADER followed by header.nentries
+   BUSYTRACE_ENTRY records, oldest first.  Each entry is a change in the
+   TS busy status or blocks ready, stamped with the CPU time stamp counter.
+*/
+#include <stdint.h>
+
+#define BUSYTRACE_MAGIC   0x43525442  /* "BTRC" */
+#define BUSYTRACE_VERSION 1
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t run;
+  uint32_t nentries;
+  uint32_t period_us;     /* sampling period */
+  uint32_t lost;          /* transitions overwritten before the dump */
+  uint64_t tsc0;          /* time stamp counter at Go */
+  double   tscPerUs;      /* time stamp counter ticks per microsecond */
+} BUSYTRACE_HEADER;
+
+typedef struct
+{
+  uint64_t tsc;
+  uint32_t busy;          /* tsGetBusyStatus */
+  uint32_t bready;        /* tsBReady */
+} BUSYTRACE_ENTRY;
+
+#endif /* _BUSYTRACE_H_INCLUDED */
@@ -0,0 +1,158 @@
+/*************************************************************************
+ *
+ *  busyTraceDecode.c - Turn a TS busy trace file (from busyTrace.c in the
+ *                      readout list) into per source busy timelines.
+ *
+ *  Usage:  busyTraceDecode [-s] <busytrace file>
+ *
+ *    Prints one line for every busy interval of every busy status bit
+ *         bit  start(us)  end(us)  length(us)
+ *    with times relative to Go, followed by a summary per bit.
+ *    -s prints the summary only.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "busyTrace.h"
+
+#define NBITS 32
+
+int
+main(int argc, char *argv[])
+{
+  BUSYTRACE_HEADER header;
+  BUSYTRACE_ENTRY entry;
+  double start[NBITS], total[NBITS], longest[NBITS], t, len, tlast = 0;
+  int count[NBITS], ibit, summaryOnly = 0, maxBready = 0;
+  unsigned int lastBusy = 0, changed;
+  unsigned int ientry;
+  char *fname;
+  FILE *fd;
+
+  if((argc == 3) && (strcmp(argv[1], "-s") == 0))
+    {
+      summaryOnly = 1;
+      fname = argv[2];
+    }
+  else if(argc == 2)
+    {
+      fname = argv[1];
+    }
+  else
+    {
+      printf("Usage: %s [-s] <busytrace file>\n", argv[0]);
+      return 1;
+    }
+
+  fd = fopen(fname, "r");
+  if(fd == NULL)
+    {
+      perror(fname);
+      return 1;
+    }
+
+  if((fread(&header, sizeof(header), 1, fd) != 1) ||
+     (header.magic != BUSYTRACE_MAGIC))
+    {
+      printf("%s: not a busy trace file\n", fname);
+      fclose(fd);
+      return 1;
+    }
+
+  if(header.version != BUSYTRACE_VERSION)
+    {
+      printf("%s: unsupported version %d\n", fname, header.version);
+      fclose(fd);
+      return 1;
+    }
+
+  printf("# Run %d: %d transitions, sampled every %d us, %d lost\n",
+	 header.run, header.nentries, header.period_us, header.lost);
+  if(!summaryOnly)
+    printf("# bit  start(us)  end(us)  length(us)\n");
+
+  memset(start, 0, sizeof(start));
+  memset(total, 0, sizeof(total));
+  memset(longest, 0, sizeof(longest));
+  memset(count, 0, sizeof(count));
+
+  for(ientry = 0; ientry < header.nentries; ientry++)
+    {
+      if(fread(&entry, sizeof(entry), 1, fd) != 1)
+	{
+	  printf("# Truncated after %d entries\n", ientry);
+	  break;
+	}
+
+      t = (double)(int64_t)(entry.tsc - header.tsc0) / header.tscPerUs;
+      tlast = t;
+
+      if((int)entry.bready > maxBready)
+	maxBready = entry.bready;
+
+      /* The first entry only sets the starting state */
+      if(ientry == 0)
+	{
+	  lastBusy = entry.busy;
+	  for(ibit = 0; ibit < NBITS; ibit++)
+	    start[ibit] = t;
+	  continue;
+	}
+
+      changed = entry.busy ^ lastBusy;
+      for(ibit = 0; ibit < NBITS; ibit++)
+	{
+	  if(!(changed & (1u << ibit)))
+	    continue;
+
+	  if(entry.busy & (1u << ibit))
+	    {
+	      start[ibit] = t;
+	    }
+	  else
+	    {
+	      len = t - start[ibit];
+	      total[ibit] += len;
+	      count[ibit]++;
+	      if(len > longest[ibit])
+		longest[ibit] = len;
+
+	      if(!summaryOnly)
+		printf("%5d  %12.2f  %12.2f  %10.2f\n",
+		       ibit, start[ibit], t, len);
+	    }
+	}
+      lastBusy = entry.busy;
+    }
+  fclose(fd);
+
+  /* Bits still busy at the end of the trace */
+  for(ibit = 0; ibit < NBITS; ibit++)
+    {
+      if(lastBusy & (1u << ibit))
+	{
+	  len = tlast - start[ibit];
+	  total[ibit] += len;
+	  count[ibit]++;
+	  if(len > longest[ibit])
+	    longest[ibit] = len;
+	}
+    }
+
+  printf("# Summary\n");
+  printf("# bit  intervals  total(us)  longest(us)  mean(us)\n");
+  for(ibit = 0; ibit < NBITS; ibit++)
+    {
+      if(count[ibit] == 0)
+	continue;
+
+      printf("# %3d  %9d  %10.1f  %11.2f  %8.2f\n",
+	     ibit, count[ibit], total[ibit], longest[ibit],
+	     total[ibit] / count[ibit]);
+    }
+  printf("# max blocks ready = %d\n", maxBready);
+
+  return 0;
+}
@@ -0,0 +1,146 @@
+#ifndef _COINCIDENCE_INCLUDED
+#define _COINCIDENCE_INCLUDED
+/* coincidence
+
+   Online overlap of the trigger inputs, from the FP input pattern that
+   each event carries with tsSetFPInputReadout(1) (event format as in
+   timestampCheck.c, pattern in word 4).
+
+   Only the histogram of the full pattern of the prescaled inputs T1-T8
+   is accumulated, one increment per event.  The pairwise coincidence
+   matrix is a sum over that histogram, done when it is read out, so it
+   costs nothing per event and is exact.  Events with inputs above T8
+   are counted, with their T1-T8 part in the histogram.
+
+   void coincidenceReset()              - clear (Prestart)
+   void coincidenceBlock(data, nwords)  - accumulate a trigger block
+   void coincidenceMatrix(m)            - pairwise counts, m[i][i] = singles
+   void coincidencePrint()              - print matrix and patterns (remex)
+   int  coincidenceWrite(char *fname)   - write them as text
+*/
+#include <stdint.h>
+
+#define COINC_NINPUTS    8
+#define COINC_NPATTERNS  (1 << COINC_NINPUTS)
+
+uint32_t coincPatterns[COINC_NPATTERNS];
+uint32_t coincEvents = 0;
+uint32_t coincOther = 0;     /* events with inputs above T8 */
+
+void
+coincidenceReset()
+{
+  memset(coincPatterns, 0, sizeof(coincPatterns));
+  coincEvents = 0;
+  coincOther = 0;
+}
+
+void
+coincidenceBlock(volatile unsigned int *data, int nwords)
+{
+  uint32_t header, fp;
+  int iword = 2;
+
+  while(iword + 4 < nwords)
+    {
+      header = data[iword];
+      if(((header >> 16) & 0xFF) != 0x01)
+	break;
+
+      if((header & 0xFFFF) >= 4)
+	{
+	  fp = data[iword + 4];
+	  coincPatterns[fp & (COINC_NPATTERNS - 1)]++;
+	  if(fp >> COINC_NINPUTS)
+	    coincOther++;
+	  coincEvents++;
+	}
+
+      iword += 1 + (header & 0xFFFF);
+    }
+}
+
+void
+coincidenceMatrix(uint32_t m[COINC_NINPUTS][COINC_NINPUTS])
+{
+  uint32_t pattern, hi, lo;
+  int i, j;
+
+  memset(m, 0, COINC_NINPUTS * sizeof(m[0]));
+
+  for(pattern = 1; pattern < COINC_NPATTERNS; pattern++)
+    {
+      if(coincPatterns[pattern] == 0)
+	continue;
+
+      for(hi = pattern; hi; hi &= hi - 1)
+	{
+	  i = __builtin_ctz(hi);
+	  for(lo = hi; lo; lo &= lo - 1)
+	    {
+	      j = __builtin_ctz(lo);
+	      m[i][j] += coincPatterns[pattern];
+	      if(j != i)
+		m[j][i] += coincPatterns[pattern];
+	    }
+	}
+    }
+}
+
+void
+coincidenceFprint(FILE *fd)
+{
+  uint32_t m[COINC_NINPUTS][COINC_NINPUTS];
+  int i, j, pattern;
+
+  coincidenceMatrix(m);
+
+  fprintf(fd, "# events %u  with inputs above T%d %u\n",
+	  coincEvents, COINC_NINPUTS, coincOther);
+  fprintf(fd, "# coincidences, diagonal = all events with the input,"
+	  " alone = events with only that input\n");
+  fprintf(fd, "#   ");
+  for(j = 0; j < COINC_NINPUTS; j++)
+    fprintf(fd, " %10s%d", "T", j + 1);
+  fprintf(fd, " %11s\n", "alone");
+
+  for(i = 0; i < COINC_NINPUTS; i++)
+    {
+      fprintf(fd, "T%d   ", i + 1);
+      for(j = 0; j < COINC_NINPUTS; j++)
+	fprintf(fd, " %11u", m[i][j]);
+      fprintf(fd, " %11u\n", coincPatterns[1 << i]);
+    }
+
+  fprintf(fd, "# pattern  events  fraction\n");
+  for(pattern = 0; pattern < COINC_NPATTERNS; pattern++)
+    if(coincPatterns[pattern])
+      fprintf(fd, "0x%02x %11u  %.6f\n", pattern, coincPatterns[pattern],
+	      (double)coincPatterns[pattern] / coincEvents);
+}
+
+void
+coincidencePrint()
+{
+  coincidenceFprint(stdout);
+}
+
+int
+coincidenceWrite(char *fname)
+{
+  FILE *fd;
+
+  fd = fopen(fname, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return -1;
+    }
+
+  coincidenceFprint(fd);
+  fclose(fd);
+
+  return 0;
+}
+
+#endif /* _COINCIDENCE_INCLUDED */
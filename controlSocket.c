@@ -0,0 +1,218 @@
+#ifndef _CONTROLSOCKET_INCLUDED
+#define _CONTROLSOCKET_INCLUDED
+/* controlSocket
+
+   Local control and query socket of the readout list (protocol in
+   controlSocket.h, client tsControl).  A thread at normal, non realtime
+   priority serves up to CONTROL_MAXCLIENTS connections on a UNIX domain
+   socket, from the load of the list to its cleanup.  It never touches the
+   readout path itself: the hook does that.
+
+   Hook the including list must define:
+     int controlHandle(CONTROL_REQUEST *req, void *data, uint32_t *nbytes)
+            - answer req, with up to CONTROL_MAXBYTES of data; return the
+              reply status
+
+   int  controlOpen(char *path) - create the socket and start the thread
+   void controlClose()          - stop the thread and remove the socket
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "controlSocket.h"
+
+#define CONTROL_MAXCLIENTS  8
+#define CONTROL_POLL_MS     200
+#define CONTROL_TIMEOUT_S   1     /* for the rest of a started request */
+
+int controlHandle(CONTROL_REQUEST *req, void *data, uint32_t *nbytes);
+
+int controlFd = -1;
+char controlPath[108];
+unsigned char controlData[CONTROL_MAXBYTES];
+
+pthread_t controlThread;
+volatile int controlRunning = 0;
+
+/* Read or write all of len, 0 on success */
+int
+controlIO(int fd, void *buf, size_t len, int out)
+{
+  char *pos = buf;
+  ssize_t n;
+
+  while(len > 0)
+    {
+      n = out ? send(fd, pos, len, MSG_NOSIGNAL) : recv(fd, pos, len, 0);
+      if(n <= 0)
+	{
+	  if((n < 0) && (errno == EINTR))
+	    continue;
+	  return -1;
+	}
+      pos += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Serve one request, -1 to drop the connection */
+int
+controlServe(int fd)
+{
+  CONTROL_REQUEST req;
+  CONTROL_REPLY rep;
+  uint32_t nbytes = 0;
+
+  if(controlIO(fd, &req, sizeof(req), 0) != 0)
+    return -1;
+
+  if((req.magic != CONTROL_MAGIC) || (req.version != CONTROL_VERSION))
+    return -1;
+
+  rep.magic = CONTROL_MAGIC;
+  rep.status = controlHandle(&req, controlData, &nbytes);
+  if(nbytes > CONTROL_MAXBYTES)
+    nbytes = 0;
+  rep.nbytes = nbytes;
+
+  if(controlIO(fd, &rep, sizeof(rep), 1) != 0)
+    return -1;
+
+  if(nbytes && (controlIO(fd, controlData, nbytes, 1) != 0))
+    return -1;
+
+  return 0;
+}
+
+void *
+controlRun(void *arg)
+{
+  struct pollfd pfd[1 + CONTROL_MAXCLIENTS];
+  struct timeval timeout = { CONTROL_TIMEOUT_S, 0 };
+  int nfd = 1, ifd, fd;
+
+  pfd[0].fd = controlFd;
+  pfd[0].events = POLLIN;
+
+  while(controlRunning)
+    {
+      if(poll(pfd, nfd, CONTROL_POLL_MS) <= 0)
+	continue;
+
+      for(ifd = nfd - 1; ifd > 0; ifd--)
+	{
+	  if(pfd[ifd].revents == 0)
+	    continue;
+
+	  if((pfd[ifd].revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+	     (controlServe(pfd[ifd].fd) != 0))
+	    {
+	      close(pfd[ifd].fd);
+	      pfd[ifd] = pfd[--nfd];
+	    }
+	}
+
+      if(pfd[0].revents & POLLIN)
+	{
+	  fd = accept(controlFd, NULL, NULL);
+	  if(fd < 0)
+	    continue;
+
+	  if(nfd > CONTROL_MAXCLIENTS)
+	    {
+	      close(fd);
+	      continue;
+	    }
+
+	  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	  pfd[nfd].fd = fd;
+	  pfd[nfd].events = POLLIN;
+	  pfd[nfd].revents = 0;
+	  nfd++;
+	}
+    }
+
+  for(ifd = 1; ifd < nfd; ifd++)
+    close(pfd[ifd].fd);
+
+  return NULL;
+}
+
+int
+controlOpen(char *path)
+{
+  struct sockaddr_un addr;
+  struct sched_param param;
+  pthread_attr_t attr;
+
+  if(controlRunning)
+    return 0;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  strncpy(controlPath, addr.sun_path, sizeof(controlPath));
+
+  controlFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(controlFd < 0)
+    {
+      perror("controlOpen: socket");
+      return -1;
+    }
+
+  unlink(controlPath);
+  if((bind(controlFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+     (listen(controlFd, CONTROL_MAXCLIENTS) != 0))
+    {
+      printf("%s: ERROR binding %s: %s\n", __func__, controlPath, strerror(errno));
+      close(controlFd);
+      controlFd = -1;
+      return -1;
+    }
+  chmod(controlPath, 0660);
+
+  /* The list may run realtime, this thread must not */
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+  param.sched_priority = 0;
+  pthread_attr_setschedparam(&attr, &param);
+
+  controlRunning = 1;
+  if(pthread_create(&controlThread, &attr, controlRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating control thread\n", __func__);
+      controlRunning = 0;
+      close(controlFd);
+      controlFd = -1;
+      unlink(controlPath);
+    }
+  pthread_attr_destroy(&attr);
+
+  if(controlRunning)
+    printf("%s: Control socket %s\n", __func__, controlPath);
+
+  return controlRunning ? 0 : -1;
+}
+
+void
+controlClose()
+{
+  if(!controlRunning)
+    return;
+
+  controlRunning = 0;
+  pthread_join(controlThread, NULL);
+
+  close(controlFd);
+  controlFd = -1;
+  unlink(controlPath);
+}
+
+#endif /* _CONTROLSOCKET_INCLUDED */
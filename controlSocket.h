@@ -0,0 +1,91 @@
+#ifndef _CONTROLSOCKET_H_INCLUDED
+#define _CONTROLSOCKET_H_INCLUDED
+/* controlSocket.h
+
+   Request/reply protocol of the local control socket served by
+   controlSocket.c in the readout list, and used by tsControl.
+
+   The client connects to the UNIX domain socket and sends CONTROL_REQUESTs.
+   Each is answered by a CONTROL_REPLY followed by reply.nbytes of data,
+   in the order the requests were sent.  A connection may be kept open for
+   any number of requests.
+*/
+#include <stdint.h>
+
+#define CONTROL_MAGIC     0x4C544354  /* "TCTL" */
+#define CONTROL_VERSION   1
+#define CONTROL_MAXBYTES  65536       /* largest reply data */
+
+/* Queries */
+#define CONTROL_CMD_PING            0 /* data: uint32 version, run */
+#define CONTROL_CMD_COUNTERS        1 /* data: CONTROL_COUNTERS */
+#define CONTROL_CMD_LATENCY         2 /* data: uint32 bin_ns, nbins, then nbins
+                                         uint32 counts, the last is overflow */
+#define CONTROL_CMD_CONFIG          3 /* data: CONTROL_CONFIG */
+#define CONTROL_CMD_COINCIDENCE     4 /* data: CONTROL_COINCIDENCE */
+
+/* Commands */
+#define CONTROL_CMD_SCALER_INHIBIT  16 /* arg[0] = 0 enable, 1 inhibit */
+#define CONTROL_CMD_TRIGGER_SOURCE  17 /* arg[0] = source (0-4), as rocSetTriggerSource */
+#define CONTROL_CMD_PRESCALE        18 /* arg[0] = input (1-8), arg[1] = prescale,
+                                          applied at the next block boundary
+                                          (at once if none comes in 0.1 s),
+                                          until the next Download */
+
+/* reply.status */
+#define CONTROL_OK          0
+#define CONTROL_EUNKNOWN   -1         /* unknown command */
+#define CONTROL_EARG       -2         /* bad argument */
+#define CONTROL_EREFUSED   -3         /* not allowed in this state */
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t cmd;
+  int32_t  arg[2];
+} CONTROL_REQUEST;
+
+typedef struct
+{
+  uint32_t magic;
+  int32_t  status;
+  uint32_t nbytes;
+} CONTROL_REPLY;
+
+typedef struct
+{
+  uint32_t run;
+  uint32_t active;          /* triggers enabled */
+  uint64_t triggers;        /* since Prestart */
+  uint32_t blocks;          /* tsGetIntCount */
+  uint32_t syncCheckErrors;
+  double   seconds;         /* since Go */
+  double   peakRate;        /* Hz */
+  double   latency50;       /* rocTrigger latency percentiles (us) */
+  double   latency99;
+} CONTROL_COUNTERS;
+
+typedef struct
+{
+  int32_t  blockLevel;
+  int32_t  bufferLevel;
+  int32_t  triggerSource;
+  int32_t  scalerInhibit;
+  int32_t  prescale[8];     /* in use, -1 = input disabled */
+  uint32_t fpEnable;        /* inputs enabled from prescale.dat */
+  uint32_t fpMasked;        /* masked by the rate controller */
+  int32_t  rateTarget;      /* rate controller target (Hz), 0 = off */
+  int32_t  nTD;
+} CONTROL_CONFIG;
+
+/* FP inputs T1-T8, see coincidence.c */
+typedef struct
+{
+  uint32_t events;
+  uint32_t other;           /* events with inputs above T8 */
+  uint32_t matrix[8][8];    /* pairwise, diagonal = singles */
+  uint32_t patterns[256];   /* events by T1-T8 pattern */
+} CONTROL_COINCIDENCE;
+
+#endif /* _CONTROLSOCKET_H_INCLUDED */
@@ -0,0 +1,373 @@
+#ifndef _CRATEMODULES_INCLUDED
+#define _CRATEMODULES_INCLUDED
+/* crateModules
+
+   Readout of extra VME modules in the TS crate, after the trigger block.
+
+   A module type is a CRATE_MODULE of callbacks.  Instances are created
+   from a '+' separated list of <type>:<args>, e.g. from the flag file
+        modules=fifo:0x08000000/32+fifo:0x08100000/16
+   (';' starts a comment and ',' ends the value in the flag file).
+   Each instance gets its own bank, tag CRATE_MODULE_BANK + instance.
+
+   Readout of a block
+     - every instance with dmaSetup() gives the VME address and size of
+       its data.  They are read with one chained (linked list) DMA, so
+       each extra module costs its transfer time but not another DMA
+       setup and completion wait.
+     - then readout() is called for every instance.  For DMA instances
+       the data is already in the bank and readout() may check or trim
+       it, but not add to it; the others read their data themselves.
+       The banks of the DMA instances come first, in the order of the
+       list, then those of the others.
+     - all of it must fit in the room the list gives for the block.  A
+       DMA instance that doesn't fit whole is left out of the block (its
+       bank is empty), the others get at most the room left as maxwords.
+       Blocks with a module left out are counted and reported at End.
+
+   'fifo' (below) is built in.  Other types are compiled into the list and
+   registered with crateModuleRegister() before Prestart.
+
+   int  crateModuleRegister(CRATE_MODULE *type)
+   int  crateModulesInit(char *list)   - create and init the instances,
+                                         then prestart() (Prestart)
+   void crateModulesArm()              - arm() (Go)
+   void crateModulesReadout(int maxwords)
+                                       - read all instances into banks at
+                                         dma_dabufp, in at most maxwords
+                                         (rocTrigger)
+   void crateModulesEnd()              - end() (End)
+*/
+
+#define CRATE_MODULE_MAXTYPES  16
+#define CRATE_MODULE_MAX       8
+#define CRATE_MODULE_BANK      0x0B00
+#define CRATE_MODULE_SEP       '+'
+
+typedef struct
+{
+  char *name;
+
+  /* Create an instance from args, return its id (>= 0) or -1 */
+  int  (*init)(char *args);
+  int  (*prestart)(int id);
+  int  (*arm)(int id);
+
+  /* Set *vmeAddr and *nbytes of this block's data for the chained DMA.
+     NULL for modules that read out in readout() */
+  int  (*dmaSetup)(int id, unsigned int *vmeAddr, unsigned int *nbytes);
+
+  /* data holds nwords from the DMA (0 without dmaSetup), room for
+     maxwords.  Return the number of words to keep */
+  int  (*readout)(int id, volatile unsigned int *data, int nwords, int maxwords);
+
+  void (*end)(int id);
+} CRATE_MODULE;
+
+typedef struct
+{
+  CRATE_MODULE *type;
+  int id;
+  int bank;
+  unsigned int vmeAddr;
+  unsigned int nbytes;    /* this block's DMA */
+} CRATE_MODULE_INSTANCE;
+
+CRATE_MODULE *crateModuleTypes[CRATE_MODULE_MAXTYPES];
+int crateModuleNtypes = 0;
+
+CRATE_MODULE_INSTANCE crateModules[CRATE_MODULE_MAX];
+int crateModuleCount = 0;
+unsigned int crateModuleShort = 0;   /* blocks with a module left out */
+
+/* Room left for each instance's data, words */
+#define CRATE_MODULE_MAXWORDS  4096
+
+/*
+  fifo:<VME A32 address>/<words>
+    Reads a fixed number of words from a FIFO or register block by DMA.
+*/
+typedef struct
+{
+  unsigned int addr;
+  unsigned int nwords;
+} CRATE_FIFO;
+
+CRATE_FIFO crateFifo[CRATE_MODULE_MAX];
+int crateFifoCount = 0;
+
+int
+crateFifoInit(char *args)
+{
+  char *end;
+
+  if(crateFifoCount >= CRATE_MODULE_MAX)
+    return -1;
+
+  crateFifo[crateFifoCount].addr = strtoul(args, &end, 0);
+  if((*end != '/') ||
+     ((crateFifo[crateFifoCount].nwords = strtoul(end + 1, NULL, 0)) == 0) ||
+     (crateFifo[crateFifoCount].nwords > CRATE_MODULE_MAXWORDS))
+    {
+      printf("%s: ERROR bad args '%s', expected <address>/<words>\n",
+	     __func__, args);
+      return -1;
+    }
+
+  return crateFifoCount++;
+}
+
+int
+crateFifoDmaSetup(int id, unsigned int *vmeAddr, unsigned int *nbytes)
+{
+  *vmeAddr = crateFifo[id].addr;
+  *nbytes = crateFifo[id].nwords << 2;
+
+  return 0;
+}
+
+int
+crateFifoReadout(int id, volatile unsigned int *data, int nwords, int maxwords)
+{
+  return nwords;
+}
+
+CRATE_MODULE crateFifoModule =
+  {
+   "fifo",
+   crateFifoInit, NULL, NULL,
+   crateFifoDmaSetup, crateFifoReadout, NULL
+  };
+
+int
+crateModuleRegister(CRATE_MODULE *type)
+{
+  if(crateModuleNtypes >= CRATE_MODULE_MAXTYPES)
+    return -1;
+
+  crateModuleTypes[crateModuleNtypes++] = type;
+
+  return 0;
+}
+
+CRATE_MODULE *
+crateModuleFind(char *name, int len)
+{
+  int itype;
+
+  if(crateModuleNtypes == 0)
+    crateModuleRegister(&crateFifoModule);
+
+  for(itype = 0; itype < crateModuleNtypes; itype++)
+    if((strlen(crateModuleTypes[itype]->name) == (size_t)len) &&
+       (strncmp(crateModuleTypes[itype]->name, name, len) == 0))
+      return crateModuleTypes[itype];
+
+  return NULL;
+}
+
+int
+crateModulesInit(char *list)
+{
+  CRATE_MODULE_INSTANCE *mod;
+  char entry[128], *colon, *pos = list;
+  int len, imod, nerr = 0;
+
+  crateFifoCount = 0;
+  crateModuleCount = 0;
+
+  if(list == NULL)
+    return 0;
+
+  while(*pos != '\0')
+    {
+      for(len = 0; (pos[len] != '\0') && (pos[len] != CRATE_MODULE_SEP); len++)
+	;
+      snprintf(entry, sizeof(entry), "%.*s", len, pos);
+      pos += len;
+      if(*pos == CRATE_MODULE_SEP)
+	pos++;
+
+      if(len == 0)
+	continue;
+
+      if(crateModuleCount >= CRATE_MODULE_MAX)
+	{
+	  daLogMsg("ERROR","More than %d crate modules", CRATE_MODULE_MAX);
+	  nerr++;
+	  break;
+	}
+
+      mod = &crateModules[crateModuleCount];
+      colon = strchr(entry, ':');
+      mod->type = crateModuleFind(entry, colon ? colon - entry : (int)strlen(entry));
+      if(mod->type == NULL)
+	{
+	  daLogMsg("ERROR","Unknown crate module type in '%s'", entry);
+	  nerr++;
+	  continue;
+	}
+
+      mod->id = mod->type->init(colon ? colon + 1 : "");
+      if(mod->id < 0)
+	{
+	  daLogMsg("ERROR","Crate module '%s' failed to initialize", entry);
+	  nerr++;
+	  continue;
+	}
+
+      mod->bank = CRATE_MODULE_BANK + crateModuleCount;
+      printf("%s: %s -> bank 0x%04x%s\n", __func__, entry, mod->bank,
+	     mod->type->dmaSetup ? " (chained DMA)" : "");
+      crateModuleCount++;
+    }
+
+  for(imod = 0; imod < crateModuleCount; imod++)
+    if(crateModules[imod].type->prestart)
+      crateModules[imod].type->prestart(crateModules[imod].id);
+
+  return nerr ? -1 : 0;
+}
+
+void
+crateModulesArm()
+{
+  int imod;
+
+  crateModuleShort = 0;
+
+  for(imod = 0; imod < crateModuleCount; imod++)
+    if(crateModules[imod].type->arm)
+      crateModules[imod].type->arm(crateModules[imod].id);
+}
+
+/* A block with a module left out, log the first of the run */
+void
+crateModuleNoRoom(CRATE_MODULE_INSTANCE *mod, int nwords, int room)
+{
+  if(crateModuleShort++ == 0)
+    logMsg("crateModulesReadout: ERROR no room in the event for bank 0x%04x "
+	   "(%d words, %d left), left out\n", mod->bank, nwords, room);
+}
+
+void
+crateModulesReadout(int maxwords)
+{
+  unsigned int vmeAddr[CRATE_MODULE_MAX], dmaSize[CRATE_MODULE_MAX];
+  volatile unsigned int *dmaBase, *src;
+  CRATE_MODULE_INSTANCE *mod;
+  int imod, ipass, ndma = 0, nwords, room, nshort = 0, retVal = 0;
+
+  /* Every bank needs a 2 word header.  The chained DMA lands
+     contiguously after room for all of them, then each module's data is
+     moved down behind its own header. */
+  dmaBase = dma_dabufp + 2*crateModuleCount;
+  room = maxwords - 2*crateModuleCount;
+  if(room < 0)
+    {
+      crateModuleNoRoom(&crateModules[0], 0, maxwords);
+      return;
+    }
+
+  for(imod = 0; imod < crateModuleCount; imod++)
+    {
+      mod = &crateModules[imod];
+      mod->nbytes = 0;
+      if(mod->type->dmaSetup == NULL)
+	continue;
+
+      if(mod->type->dmaSetup(mod->id, &mod->vmeAddr, &mod->nbytes) < 0)
+	mod->nbytes = 0;
+      if(mod->nbytes == 0)
+	continue;
+
+      /* Only whole reads: a partial one would leave data in the module */
+      nwords = (mod->nbytes + 3) >> 2;
+      if(nwords > room)
+	{
+	  if(!nshort++)
+	    crateModuleNoRoom(mod, nwords, room);
+	  mod->nbytes = 0;
+	  continue;
+	}
+      room -= nwords;
+
+      vmeAddr[ndma] = mod->vmeAddr;
+      dmaSize[ndma] = mod->nbytes;
+      ndma++;
+    }
+
+  if(ndma == 1)
+    retVal = vmeDmaSend((unsigned long)dmaBase, vmeAddr[0], dmaSize[0]);
+  else if(ndma > 1)
+    {
+      vmeDmaSetupLL((unsigned long)dmaBase, vmeAddr, dmaSize, ndma);
+      retVal = vmeDmaSendLL();
+    }
+
+  if(ndma > 0)
+    {
+      if(retVal == 0)
+	retVal = vmeDmaDone();
+
+      if(retVal < 0)
+	{
+	  logMsg("crateModulesReadout: ERROR DMA of %d module(s) failed\n", ndma);
+	  for(imod = 0; imod < crateModuleCount; imod++)
+	    crateModules[imod].nbytes = 0;
+	}
+    }
+
+  /* DMA instances first, so nothing is written over data still to move */
+  src = dmaBase;
+  for(ipass = 0; ipass < 2; ipass++)
+    {
+      for(imod = 0; imod < crateModuleCount; imod++)
+	{
+	  mod = &crateModules[imod];
+	  if((mod->type->dmaSetup != NULL) != (ipass == 0))
+	    continue;
+
+	  nwords = mod->nbytes >> 2;
+
+	  BANKOPEN(mod->bank, BT_UI4, blockLevel);
+	  if(nwords > 0)
+	    {
+	      if(src != dma_dabufp)
+		memmove((void *)dma_dabufp, (void *)src, nwords << 2);
+	      src += nwords;
+	    }
+
+	  if(ipass == 1)
+	    nwords = (room < CRATE_MODULE_MAXWORDS) ? room : CRATE_MODULE_MAXWORDS;
+
+	  retVal = mod->type->readout(mod->id, dma_dabufp, (ipass == 0) ? nwords : 0,
+				      nwords);
+	  if(retVal > nwords)
+	    retVal = nwords;
+	  if(retVal > 0)
+	    {
+	      dma_dabufp += retVal;
+	      if(ipass == 1)
+		room -= retVal;
+	    }
+	  BANKCLOSE;
+	}
+    }
+}
+
+void
+crateModulesEnd()
+{
+  int imod;
+
+  if(crateModuleShort)
+    daLogMsg("WARN","%u blocks with crate module data left out for lack of room",
+	     crateModuleShort);
+
+  for(imod = 0; imod < crateModuleCount; imod++)
+    if(crateModules[imod].type->end)
+      crateModules[imod].type->end(crateModules[imod].id);
+}
+
+#endif /* _CRATEMODULES_INCLUDED */
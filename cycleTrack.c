@@ -0,0 +1,153 @@
+#ifndef _CYCLETRACK_INCLUDED
+#define _CYCLETRACK_INCLUDED
+/* cycleTrack
+
+   Memory, file descriptors and transition time of each run cycle of a
+   list that stays loaded for weeks, to catch the small per run leaks and
+   slowdowns that only add up over many cycles.
+
+   A cycle ends at each End.  Its resident set, heap in use, open file
+   descriptors and the total time of the transitions since the last End
+   are appended to the log, and the least squares trend of each over the
+   last CYCLE_WINDOW cycles is checked: a steady rise is reported with
+   daLogMsg.  Soak a list by cycling the transitions from run control,
+   then read the log or watch for the warnings.
+
+   void cycleTrackTransition(double ms) - add a transition (after each)
+   void cycleTrackEnd(char *fname)      - close the cycle, append it to
+                                          fname and check the trends (End)
+*/
+#include <stddef.h>
+#include <malloc.h>
+#include <dirent.h>
+
+#define CYCLE_WINDOW     20
+#define CYCLE_RSS_KB     256    /* growth over the window reported */
+#define CYCLE_HEAP_KB    256
+#define CYCLE_FDS        2
+#define CYCLE_TIME_FRAC  0.2    /* of the mean transition time */
+
+typedef struct
+{
+  double rssKB;
+  double heapKB;
+  double fds;
+  double ms;        /* transitions of the cycle */
+} CYCLE_SAMPLE;
+
+CYCLE_SAMPLE cycleRing[CYCLE_WINDOW];
+unsigned int cycleCount = 0;
+double cycleMs = 0;
+
+void
+cycleTrackTransition(double ms)
+{
+  cycleMs += ms;
+}
+
+void
+cycleTrackSample(CYCLE_SAMPLE *s)
+{
+  long pages = 0, resident = 0;
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+#else
+  struct mallinfo mi = mallinfo();
+#endif
+  struct dirent *entry;
+  DIR *dir;
+  FILE *fd;
+
+  fd = fopen("/proc/self/statm", "r");
+  if(fd)
+    {
+      if(fscanf(fd, "%ld %ld", &pages, &resident) != 2)
+	resident = 0;
+      fclose(fd);
+    }
+  s->rssKB = resident * (sysconf(_SC_PAGESIZE) / 1024.);
+
+  s->heapKB = ((double)mi.uordblks + mi.hblkhd) / 1024.;
+
+  s->fds = 0;
+  dir = opendir("/proc/self/fd");
+  if(dir)
+    {
+      while((entry = readdir(dir)) != NULL)
+	if(entry->d_name[0] != '.')
+	  s->fds++;
+      closedir(dir);
+      s->fds--;   /* this directory */
+    }
+
+  s->ms = cycleMs;
+}
+
+/* Least squares slope per cycle of field off over the window */
+double
+cycleSlope(size_t off)
+{
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, y;
+  int i, n = CYCLE_WINDOW;
+
+  for(i = 0; i < n; i++)
+    {
+      y = *(double *)((char *)&cycleRing[(cycleCount - n + i) % CYCLE_WINDOW] + off);
+      sx += i;
+      sy += y;
+      sxx += (double)i * i;
+      sxy += i * y;
+    }
+
+  return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+void
+cycleTrackEnd(char *fname)
+{
+  CYCLE_SAMPLE *s = &cycleRing[cycleCount % CYCLE_WINDOW];
+  double growth, mean = 0;
+  int i;
+  FILE *fd;
+
+  cycleTrackSample(s);
+  cycleCount++;
+  cycleMs = 0;
+
+  fd = fopen(fname, "a");
+  if(fd)
+    {
+      fprintf(fd, "%ld %d %u %.0f %.0f %.0f %.2f\n", (long)time(NULL),
+	      rol->runNumber, cycleCount, s->rssKB, s->heapKB, s->fds, s->ms);
+      fclose(fd);
+    }
+  else
+    printf("%s: ERROR opening %s\n", __func__, fname);
+
+  if(cycleCount < CYCLE_WINDOW)
+    return;
+
+  growth = CYCLE_WINDOW * cycleSlope(offsetof(CYCLE_SAMPLE, rssKB));
+  if(growth > CYCLE_RSS_KB)
+    daLogMsg("WARN","Resident memory grew %.0f kB over the last %d runs",
+	     growth, CYCLE_WINDOW);
+
+  growth = CYCLE_WINDOW * cycleSlope(offsetof(CYCLE_SAMPLE, heapKB));
+  if(growth > CYCLE_HEAP_KB)
+    daLogMsg("WARN","Heap in use grew %.0f kB over the last %d runs",
+	     growth, CYCLE_WINDOW);
+
+  growth = CYCLE_WINDOW * cycleSlope(offsetof(CYCLE_SAMPLE, fds));
+  if(growth >= CYCLE_FDS)
+    daLogMsg("WARN","Open files grew by %.0f over the last %d runs",
+	     growth, CYCLE_WINDOW);
+
+  for(i = 0; i < CYCLE_WINDOW; i++)
+    mean += cycleRing[i].ms / CYCLE_WINDOW;
+  growth = CYCLE_WINDOW * cycleSlope(offsetof(CYCLE_SAMPLE, ms));
+  if(growth > CYCLE_TIME_FRAC * mean)
+    daLogMsg("WARN","Transition time grew %.0f ms over the last %d runs (mean %.0f ms)",
+	     growth, CYCLE_WINDOW, mean);
+}
+
+#endif /* _CYCLETRACK_INCLUDED */
@@ -0,0 +1,311 @@
+#ifndef _FAULTINJECT_INCLUDED
+#define _FAULTINJECT_INCLUDED
+/* faultInject
+
+   Fault injection for test stand runs, to exercise the error paths of the
+   readout lists under load.  Compiled in only with -DFAULT_INJECT; without
+   it the FAULT_* wrappers below are the plain library calls.
+
+   Faults (bit in faultMask):
+     FAULT_DMA_SHORT   tsReadTriggerBlock returns half of the block
+     FAULT_DMA_FAIL    tsReadTriggerBlock returns an error
+     FAULT_SYNC        sync flag set on a normal block
+     FAULT_BLOCKLEVEL  TS reports a different block level at a sync event
+     FAULT_TD_MISSING  the last TD found by tdInit is hidden (Download)
+     FAULT_NO_TRIGSRC  the lowest enabled fiber port of each TD reports no
+                       trigger source (Prestart)
+
+   The block faults each fire on about 1 in faultRate blocks, the
+   transition faults every time the call is made.  Download comes before
+   the flags are read, so it uses the mask of the last Prestart.
+
+   Every block with a fault gets a FAULT_BANK bank after its trigger bank,
+   (fault type, block number, count of that fault), so that the damaged
+   blocks can be told apart from real errors in the data.
+
+   For each block fault, the cost is the readout time of the faulted
+   blocks over the mean of the clean ones.  The recovery time is from the
+   fault to the end of the first block after which the readout is right
+   again: a block without a fault whose trigger bank is complete (its
+   length word matches what was read, with blockLevel events), and, for
+   the faults that leave wrong state behind (sync, blocklevel), that is a
+   real sync event, where the block level and the sync checks start over.
+
+   void faultInjectReset(int mask, int rate) - arm the faults (Prestart)
+   void faultInjectTag(int evntno)            - FAULT_BANK for this block
+   void faultInjectBlockDone(ns, complete, sync)
+                                              - account a block (trigger
+                                                path)
+   void faultInjectPrint()                    - print the results (remex)
+   int  faultInjectWrite(char *fname)         - write the results as text
+*/
+
+#define FAULT_DMA_SHORT   0
+#define FAULT_DMA_FAIL    1
+#define FAULT_SYNC        2
+#define FAULT_BLOCKLEVEL  3
+#define FAULT_TD_MISSING  4
+#define FAULT_NO_TRIGSRC  5
+#define FAULT_NTYPES      6
+
+#define FAULT_BANK        0x0BFA
+
+/* Faults whose damage lasts until the next real sync event */
+#define FAULT_UNTIL_SYNC(type)  (((type) == FAULT_SYNC) || ((type) == FAULT_BLOCKLEVEL))
+
+#ifdef FAULT_INJECT
+
+#include <stdint.h>
+
+char *faultNames[FAULT_NTYPES] =
+  {
+   "dma_short",
+   "dma_fail",
+   "sync",
+   "blocklevel",
+   "td_missing",
+   "no_trigsrc"
+  };
+
+int faultMask = 0;
+int faultRate = 1000;
+uint32_t faultSeed = 0x2545F491;
+
+/* Fault injected in the current block, -1 = none */
+int faultThisBlock = -1;
+
+unsigned int faultCount[FAULT_NTYPES];
+double faultCostNs[FAULT_NTYPES];          /* readout time of faulted blocks */
+double faultRecoveryNs[FAULT_NTYPES];
+double faultRecoveryMaxNs[FAULT_NTYPES];
+unsigned int faultRecovered[FAULT_NTYPES];
+double faultCleanNs = 0;
+unsigned long long faultCleanBlocks = 0;
+
+/* Fault waiting for a clean block */
+int faultPending = -1;
+struct timespec faultPendingTime;
+
+static inline uint32_t
+faultRandom()
+{
+  /* xorshift32 */
+  faultSeed ^= faultSeed << 13;
+  faultSeed ^= faultSeed >> 17;
+  faultSeed ^= faultSeed << 5;
+  return faultSeed;
+}
+
+/* Inject fault type in this block? */
+static inline int
+faultFire(int type)
+{
+  if(!(faultMask & (1 << type)) || (faultThisBlock >= 0))
+    return 0;
+
+  if((faultRandom() % faultRate) != 0)
+    return 0;
+
+  faultThisBlock = type;
+  faultCount[type]++;
+  clock_gettime(CLOCK_MONOTONIC, &faultPendingTime);
+  faultPending = type;
+
+  return 1;
+}
+
+static inline int
+faultTsReadTriggerBlock(volatile unsigned int *data)
+{
+  int dCnt = tsReadTriggerBlock(data);
+
+  if((dCnt > 1) && faultFire(FAULT_DMA_SHORT))
+    return dCnt / 2;
+
+  if(faultFire(FAULT_DMA_FAIL))
+    return -1;
+
+  return dCnt;
+}
+
+static inline int
+faultSyncFlag(int flag)
+{
+  if(!flag && faultFire(FAULT_SYNC))
+    return 1;
+
+  return flag;
+}
+
+static inline int
+faultBlockLevel(int level)
+{
+  if(faultFire(FAULT_BLOCKLEVEL))
+    return (level < 254) ? level + 1 : 1;
+
+  return level;
+}
+
+void
+faultTDInit()
+{
+  if((faultMask & (1 << FAULT_TD_MISSING)) && (nTD > 0))
+    {
+      faultCount[FAULT_TD_MISSING] = 1;
+      nTD--;
+      daLogMsg("WARN","Fault injected: TD in slot %d hidden", tdID[nTD]);
+    }
+}
+
+static inline unsigned int
+faultTrigSrcMask(unsigned int mask)
+{
+  if((faultMask & (1 << FAULT_NO_TRIGSRC)) && mask)
+    {
+      faultCount[FAULT_NO_TRIGSRC]++;
+      return mask & (mask - 1);   /* lowest enabled port drops out */
+    }
+
+  return mask;
+}
+
+#define FAULT_TS_READ(data)        faultTsReadTriggerBlock(data)
+#define FAULT_SYNC_FLAG(flag)      faultSyncFlag(flag)
+#define FAULT_BLOCKLEVEL_READ(bl)  faultBlockLevel(bl)
+#define FAULT_TD_INIT()            faultTDInit()
+#define FAULT_TRIGSRC(mask)        faultTrigSrcMask(mask)
+
+void
+faultInjectReset(int mask, int rate)
+{
+  unsigned int tdMissing = faultCount[FAULT_TD_MISSING];  /* from Download */
+
+  faultMask = mask;
+  faultRate = (rate > 0) ? rate : 1000;
+  faultThisBlock = -1;
+  faultPending = -1;
+  memset(faultCount, 0, sizeof(faultCount));
+  faultCount[FAULT_TD_MISSING] = tdMissing;
+  memset(faultCostNs, 0, sizeof(faultCostNs));
+  memset(faultRecoveryNs, 0, sizeof(faultRecoveryNs));
+  memset(faultRecoveryMaxNs, 0, sizeof(faultRecoveryMaxNs));
+  memset(faultRecovered, 0, sizeof(faultRecovered));
+  faultCleanNs = 0;
+  faultCleanBlocks = 0;
+
+  if(faultMask)
+    daLogMsg("WARN","Fault injection armed: mask 0x%x, 1 in %d blocks",
+	     faultMask, faultRate);
+}
+
+/* Tag the block with the fault injected in it, after its trigger bank */
+void
+faultInjectTag(int evntno)
+{
+  if(faultThisBlock < 0)
+    return;
+
+  BANKOPEN(FAULT_BANK, BT_UI4, blockLevel);
+  *dma_dabufp++ = faultThisBlock;
+  *dma_dabufp++ = evntno;
+  *dma_dabufp++ = faultCount[faultThisBlock];
+  BANKCLOSE;
+}
+
+void
+faultInjectBlockDone(unsigned int ns, int complete, int sync)
+{
+  struct timespec now;
+  double recovery;
+
+  if(faultThisBlock >= 0)
+    {
+      faultCostNs[faultThisBlock] += ns;
+      faultThisBlock = -1;
+      return;
+    }
+
+  faultCleanNs += ns;
+  faultCleanBlocks++;
+
+  if(faultPending < 0)
+    return;
+
+  /* Not recovered yet */
+  if(!complete || (FAULT_UNTIL_SYNC(faultPending) && !sync))
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  recovery = 1e9*(now.tv_sec - faultPendingTime.tv_sec) +
+    (now.tv_nsec - faultPendingTime.tv_nsec);
+
+  faultRecoveryNs[faultPending] += recovery;
+  if(recovery > faultRecoveryMaxNs[faultPending])
+    faultRecoveryMaxNs[faultPending] = recovery;
+  faultRecovered[faultPending]++;
+  faultPending = -1;
+}
+
+void
+faultInjectFprint(FILE *fd)
+{
+  double clean;
+  int itype;
+
+  clean = faultCleanBlocks ? faultCleanNs / faultCleanBlocks : 0;
+
+  fprintf(fd, "# mask 0x%x  rate 1/%d  clean blocks %llu  mean %.2f us\n",
+	  faultMask, faultRate, faultCleanBlocks, 1e-3 * clean);
+  fprintf(fd, "# fault        count  extra_us  recovered  recovery_us  max_us\n");
+
+  for(itype = 0; itype < FAULT_NTYPES; itype++)
+    {
+      if(!(faultMask & (1 << itype)))
+	continue;
+
+      fprintf(fd, "%-12s %7u  %8.2f  %9u  %11.2f  %6.1f\n",
+	      faultNames[itype], faultCount[itype],
+	      faultCount[itype] ?
+	      1e-3 * (faultCostNs[itype] / faultCount[itype] - clean) : 0,
+	      faultRecovered[itype],
+	      faultRecovered[itype] ?
+	      1e-3 * faultRecoveryNs[itype] / faultRecovered[itype] : 0,
+	      1e-3 * faultRecoveryMaxNs[itype]);
+    }
+}
+
+void
+faultInjectPrint()
+{
+  faultInjectFprint(stdout);
+}
+
+int
+faultInjectWrite(char *fname)
+{
+  FILE *fd;
+
+  fd = fopen(fname, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return -1;
+    }
+
+  faultInjectFprint(fd);
+  fclose(fd);
+
+  return 0;
+}
+
+#else /* FAULT_INJECT */
+
+#define FAULT_TS_READ(data)        tsReadTriggerBlock(data)
+#define FAULT_SYNC_FLAG(flag)      (flag)
+#define FAULT_BLOCKLEVEL_READ(bl)  (bl)
+#define FAULT_TD_INIT()
+#define FAULT_TRIGSRC(mask)        (mask)
+
+#endif /* FAULT_INJECT */
+
+#endif /* _FAULTINJECT_INCLUDED */
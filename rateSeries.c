@@ -0,0 +1,233 @@
+#ifndef _RATESERIES_INCLUDED
+#define _RATESERIES_INCLUDED
+/* rateSeries
+
+   Rate and livetime time series of a run, sampled by a background thread
+   every period_ms from Go to End into a memory mapped file (see
+   rateSeries.h).  The mapping reserves room for maxSamples, but the file
+   only gets disk space RATESERIES_GROW bytes at a time, from the sampler
+   thread as the samples reach it, and is cut to the samples written at
+   End.  Storing a sample is a copy into the mapping.  When the file is
+   full, or can't grow, the remaining samples are counted as dropped.
+
+   Hook the including list must define:
+     void rateSeriesFill(RATESERIES_SAMPLE *sample, double seconds)
+            - fill everything but t_ms; seconds is the time since the
+              last sample
+
+   int  rateSeriesOpen(char *fname, int period_ms, int maxSamples)
+                                      - create the file (Prestart)
+   void rateSeriesBlock(data, nwords) - count the FP inputs of the events
+                                        in a trigger block (rocTrigger)
+   void rateSeriesStart()             - start sampling (Go)
+   void rateSeriesStop()              - stop sampling and unmap (End)
+
+   Export the file to CSV with rateSeriesCsv.
+*/
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "rateSeries.h"
+
+#define RATESERIES_GROW  (1 << 20)   /* bytes of file added at a time */
+
+void rateSeriesFill(RATESERIES_SAMPLE *sample, double seconds);
+void rateSeriesStop();
+
+RATESERIES_HEADER *rateSeriesHeader = NULL;
+RATESERIES_SAMPLE *rateSeriesData = NULL;
+size_t rateSeriesSize = 0;     /* mapped, for maxSamples */
+size_t rateSeriesAlloc = 0;    /* allocated in the file */
+int rateSeriesFd = -1;
+
+/* Accepted triggers per FP input since Prestart */
+uint32_t rateSeriesInputs[RATESERIES_NINPUTS];
+
+pthread_t rateSeriesThread;
+volatile int rateSeriesRunning = 0;
+
+/* Make sure the file has the first need bytes, 0 if it does */
+int
+rateSeriesGrow(size_t need)
+{
+  size_t size;
+
+  if(need <= rateSeriesAlloc)
+    return 0;
+
+  size = rateSeriesAlloc + RATESERIES_GROW;
+  if(size < need)
+    size = need;
+  if(size > rateSeriesSize)
+    size = rateSeriesSize;
+
+  if(posix_fallocate(rateSeriesFd, 0, size) != 0)
+    return -1;
+
+  rateSeriesAlloc = size;
+  return 0;
+}
+
+int
+rateSeriesOpen(char *fname, int period_ms, int maxSamples)
+{
+  void *map;
+
+  rateSeriesStop();
+
+  if((period_ms <= 0) || (maxSamples <= 0))
+    return -1;
+
+  rateSeriesFd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(rateSeriesFd < 0)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return -1;
+    }
+
+  rateSeriesSize = RATESERIES_PAGE + (size_t)maxSamples * sizeof(RATESERIES_SAMPLE);
+  rateSeriesAlloc = 0;
+  map = MAP_FAILED;
+  if(rateSeriesGrow(RATESERIES_PAGE) == 0)
+    map = mmap(NULL, rateSeriesSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+	       rateSeriesFd, 0);
+  if(map == MAP_FAILED)
+    {
+      printf("%s: ERROR creating %s\n", __func__, fname);
+      close(rateSeriesFd);
+      rateSeriesFd = -1;
+      return -1;
+    }
+  rateSeriesHeader = (RATESERIES_HEADER *)map;
+
+  rateSeriesData = (RATESERIES_SAMPLE *)((char *)rateSeriesHeader + RATESERIES_PAGE);
+
+  memset(rateSeriesHeader, 0, sizeof(RATESERIES_HEADER));
+  rateSeriesHeader->magic = RATESERIES_MAGIC;
+  rateSeriesHeader->version = RATESERIES_VERSION;
+  rateSeriesHeader->run = rol->runNumber;
+  rateSeriesHeader->period_ms = period_ms;
+  rateSeriesHeader->maxSamples = maxSamples;
+  memset(rateSeriesInputs, 0, sizeof(rateSeriesInputs));
+
+  printf("%s: Rate series every %d ms to %s (%d samples)\n",
+	 __func__, period_ms, fname, maxSamples);
+
+  return 0;
+}
+
+/* Trigger block format as in timestampCheck.c, FP pattern in word 4 */
+void
+rateSeriesBlock(volatile unsigned int *data, int nwords)
+{
+  uint32_t header, fp;
+  int iword = 2;
+
+  while(iword + 4 < nwords)
+    {
+      header = data[iword];
+      if(((header >> 16) & 0xFF) != 0x01)
+	break;
+
+      if((header & 0xFFFF) >= 4)
+	{
+	  fp = data[iword + 4];
+	  while(fp)
+	    {
+	      rateSeriesInputs[__builtin_ctz(fp)]++;
+	      fp &= fp - 1;
+	    }
+	}
+
+      iword += 1 + (header & 0xFFFF);
+    }
+}
+
+void *
+rateSeriesRun(void *arg)
+{
+  RATESERIES_HEADER *h = rateSeriesHeader;
+  RATESERIES_SAMPLE *sample;
+  struct timespec start, next, last, now;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  last = next = start;
+
+  while(rateSeriesRunning)
+    {
+      next.tv_nsec += h->period_ms * 1000000L;
+      while(next.tv_nsec >= 1000000000L)
+	{
+	  next.tv_nsec -= 1000000000L;
+	  next.tv_sec++;
+	}
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      if((h->nsamples >= h->maxSamples) ||
+	 (rateSeriesGrow(RATESERIES_PAGE +
+			 (h->nsamples + 1) * sizeof(RATESERIES_SAMPLE)) != 0))
+	{
+	  h->dropped++;
+	  continue;
+	}
+
+      sample = &rateSeriesData[h->nsamples];
+      memset(sample, 0, sizeof(RATESERIES_SAMPLE));
+      sample->t_ms = 1000*(now.tv_sec - start.tv_sec) +
+	(now.tv_nsec - start.tv_nsec) / 1000000;
+      rateSeriesFill(sample, (now.tv_sec - last.tv_sec) +
+		     1e-9*(now.tv_nsec - last.tv_nsec));
+      last = now;
+
+      /* Publish the sample only after it is complete */
+      __atomic_store_n(&h->nsamples, h->nsamples + 1, __ATOMIC_RELEASE);
+    }
+
+  return NULL;
+}
+
+void
+rateSeriesStart()
+{
+  if(rateSeriesHeader == NULL)
+    return;
+
+  rateSeriesHeader->start = time(NULL);
+
+  rateSeriesRunning = 1;
+  if(pthread_create(&rateSeriesThread, NULL, rateSeriesRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating sampler thread\n", __func__);
+      rateSeriesRunning = 0;
+    }
+}
+
+void
+rateSeriesStop()
+{
+  if(rateSeriesRunning)
+    {
+      rateSeriesRunning = 0;
+      pthread_join(rateSeriesThread, NULL);
+    }
+
+  if(rateSeriesHeader == NULL)
+    return;
+
+  printf("%s: %d samples written (%d dropped)\n",
+	 __func__, rateSeriesHeader->nsamples, rateSeriesHeader->dropped);
+
+  /* Give back the space allocated ahead */
+  if(ftruncate(rateSeriesFd, RATESERIES_PAGE + (size_t)rateSeriesHeader->nsamples *
+	       sizeof(RATESERIES_SAMPLE)) != 0)
+    printf("%s: ERROR truncating the rate series file\n", __func__);
+
+  munmap(rateSeriesHeader, rateSeriesSize);
+  close(rateSeriesFd);
+  rateSeriesFd = -1;
+  rateSeriesHeader = NULL;
+  rateSeriesData = NULL;
+}
+
+#endif /* _RATESERIES_INCLUDED */
@@ -0,0 +1,46 @@
+#ifndef _RATESERIES_H_INCLUDED
+#define _RATESERIES_H_INCLUDED
+/* rateSeries.h
+
+   File format of the rate and livetime time series written by rateSeries.c
+   and read by rateSeriesCsv.
+
+   The file is a RATESERIES_HEADER, padded to RATESERIES_PAGE bytes, then
+   up to header.maxSamples RATESERIES_SAMPLE records.  The first
+   header.nsamples are valid; the file may end before maxSamples.  Counters are totals since Go, so rates come
+   from the difference of two samples.
+*/
+#include <stdint.h>
+
+#define RATESERIES_MAGIC    0x52455352  /* "RSER" */
+#define RATESERIES_VERSION  2           /* 1: livetime was 0..1 */
+#define RATESERIES_PAGE     4096
+#define RATESERIES_NINPUTS  32          /* TS front panel inputs */
+#define RATESERIES_MAXROCS  16
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t run;
+  uint32_t period_ms;     /* sampling period */
+  uint32_t maxSamples;
+  uint32_t nsamples;      /* samples written so far */
+  uint32_t dropped;       /* samples that didn't fit */
+  uint32_t nrocs;
+  int64_t  start;         /* unix time at Go */
+  char     rocname[RATESERIES_MAXROCS][32];
+} RATESERIES_HEADER;
+
+typedef struct
+{
+  uint32_t t_ms;          /* since Go */
+  uint32_t blocks;        /* blocks read out */
+  uint64_t triggers;      /* events read out */
+  uint32_t inputs[RATESERIES_NINPUTS];  /* accepted triggers per FP input */
+  float    livetime;      /* over the last period, percent */
+  float    busy[RATESERIES_MAXROCS];    /* over the last period, 0..1 */
+  uint32_t bready;        /* blocks waiting in the TS */
+} RATESERIES_SAMPLE;
+
+#endif /* _RATESERIES_H_INCLUDED */
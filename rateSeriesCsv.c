@@ -0,0 +1,132 @@
+/*************************************************************************
+ *
+ *  rateSeriesCsv.c - Export a rate series file (from rateSeries.c in the
+ *                    readout list) to CSV.
+ *
+ *  Usage:  rateSeriesCsv [-c] <rateseries file>
+ *
+ *    Prints one line per sample
+ *      time_s, block_rate_hz, trigger_rate_hz, livetime_pct, bready,
+ *      <roc>_busy for each ROC, in<N>_hz for each front panel input
+ *    Rates are over the period since the previous sample.
+ *    -c prints the counters since Go instead of rates.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rateSeries.h"
+
+int
+main(int argc, char *argv[])
+{
+  RATESERIES_HEADER header;
+  RATESERIES_SAMPLE sample, last;
+  unsigned int isample, iroc, iinput;
+  int counters = 0;
+  double dt;
+  char *fname;
+  FILE *fd;
+
+  if((argc == 3) && (strcmp(argv[1], "-c") == 0))
+    {
+      counters = 1;
+      fname = argv[2];
+    }
+  else if(argc == 2)
+    {
+      fname = argv[1];
+    }
+  else
+    {
+      printf("Usage: %s [-c] <rateseries file>\n", argv[0]);
+      return 1;
+    }
+
+  fd = fopen(fname, "r");
+  if(fd == NULL)
+    {
+      perror(fname);
+      return 1;
+    }
+
+  if((fread(&header, sizeof(header), 1, fd) != 1) ||
+     (header.magic != RATESERIES_MAGIC))
+    {
+      fprintf(stderr, "%s: not a rate series file\n", fname);
+      fclose(fd);
+      return 1;
+    }
+
+  if((header.version != RATESERIES_VERSION) && (header.version != 1))
+    {
+      fprintf(stderr, "%s: unsupported version %d\n", fname, header.version);
+      fclose(fd);
+      return 1;
+    }
+
+  if(header.nrocs > RATESERIES_MAXROCS)
+    header.nrocs = RATESERIES_MAXROCS;
+
+  fprintf(stderr, "# Run %d: %d samples every %d ms, %d dropped, start %lld\n",
+	  header.run, header.nsamples, header.period_ms, header.dropped,
+	  (long long)header.start);
+
+  printf("time_s,%s,%s,livetime_pct,bready",
+	 counters ? "blocks" : "block_rate_hz",
+	 counters ? "triggers" : "trigger_rate_hz");
+  for(iroc = 0; iroc < header.nrocs; iroc++)
+    printf(",%s_busy", header.rocname[iroc]);
+  for(iinput = 0; iinput < RATESERIES_NINPUTS; iinput++)
+    printf(counters ? ",in%d" : ",in%d_hz", iinput + 1);
+  printf("\n");
+
+  if(fseek(fd, RATESERIES_PAGE, SEEK_SET) != 0)
+    {
+      fprintf(stderr, "%s: truncated\n", fname);
+      fclose(fd);
+      return 1;
+    }
+
+  memset(&last, 0, sizeof(last));
+  for(isample = 0; isample < header.nsamples; isample++)
+    {
+      if(fread(&sample, sizeof(sample), 1, fd) != 1)
+	{
+	  fprintf(stderr, "# Truncated after %d samples\n", isample);
+	  break;
+	}
+
+      dt = 1e-3 * (sample.t_ms - last.t_ms);
+      if(dt <= 0)
+	dt = 1e-3 * header.period_ms;
+
+      printf("%.3f", 1e-3 * sample.t_ms);
+      if(counters)
+	printf(",%u,%llu", sample.blocks, (unsigned long long)sample.triggers);
+      else
+	printf(",%.1f,%.1f", (sample.blocks - last.blocks) / dt,
+	       (double)(sample.triggers - last.triggers) / dt);
+      if(header.version == 1)
+	sample.livetime *= 100;
+      printf(",%.2f,%u", sample.livetime, sample.bready);
+
+      for(iroc = 0; iroc < header.nrocs; iroc++)
+	printf(",%.4f", sample.busy[iroc]);
+
+      for(iinput = 0; iinput < RATESERIES_NINPUTS; iinput++)
+	{
+	  if(counters)
+	    printf(",%u", sample.inputs[iinput]);
+	  else
+	    printf(",%.1f", (sample.inputs[iinput] - last.inputs[iinput]) / dt);
+	}
+      printf("\n");
+
+      last = sample;
+    }
+  fclose(fd);
+
+  return 0;
+}
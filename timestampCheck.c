@@ -0,0 +1,183 @@
+#ifndef _TIMESTAMPCHECK_INCLUDED
+#define _TIMESTAMPCHECK_INCLUDED
+/* timestampCheck
+
+   Online check of the 48 bit event timestamps in the TS trigger block,
+   and histograms of the interval between triggers, per event type.
+
+   Trigger block from tsReadTriggerBlock with tsSetEventFormat(3)
+     word 0   : bank length
+     word 1   : bank header  0xFF1X20NN  (NN = number of events)
+     then for each event
+     word 0   : event type << 24 | 0x01 << 16 | number of words that follow
+     word 1   : event number
+     word 2   : timestamp bits 31:0
+     word 3   : timestamp bits 47:32 (bits 15:0)
+     word 4.. : FP input pattern, if enabled
+
+   Intervals are histogrammed in log2 bins of TS clock ticks (4 ns):
+   bin n holds intervals in [2^n, 2^(n+1)) ticks, bin 0 also holds 0.
+   An interval that goes backwards is counted as a glitch, a step across
+   2^48 as a wrap.
+
+   void timestampCheckReset()                 - clear (Prestart)
+   void timestampCheckBlock(data, nwords)     - check one trigger block
+   void timestampCheckPrint()                 - print histograms (remex)
+   int  timestampCheckWrite(char *fname)      - write histograms as text
+*/
+#include <stdint.h>
+
+#define TSCHECK_MAXEVENTS  256      /* events per block */
+#define TSCHECK_NTYPES     256
+#define TSCHECK_NBINS      48
+#define TSCHECK_MASK48     0xFFFFFFFFFFFFULL
+#define TSCHECK_TICK_NS    4
+
+uint32_t tsCheckHist[TSCHECK_NTYPES][TSCHECK_NBINS];
+uint64_t tsCheckLast = 0;
+int tsCheckHaveLast = 0;
+unsigned int tsCheckEvents = 0, tsCheckGlitches = 0, tsCheckWraps = 0;
+unsigned int tsCheckFormatErrors = 0;
+
+void
+timestampCheckReset()
+{
+  memset(tsCheckHist, 0, sizeof(tsCheckHist));
+  tsCheckHaveLast = 0;
+  tsCheckEvents = 0;
+  tsCheckGlitches = 0;
+  tsCheckWraps = 0;
+  tsCheckFormatErrors = 0;
+}
+
+void
+timestampCheckBlock(volatile unsigned int *data, int nwords)
+{
+  uint64_t stamp[TSCHECK_MAXEVENTS + 1], delta[TSCHECK_MAXEVENTS];
+  uint8_t type[TSCHECK_MAXEVENTS];
+  int nev = 0, iev, iword, bin, backwards = 0, wraps = 0;
+  uint32_t header;
+
+  if(nwords < 2)
+    return;
+
+  /* Gather the timestamps and event types of the block */
+  stamp[0] = tsCheckLast;
+  iword = 2;
+  while((iword + 3 < nwords) && (nev < TSCHECK_MAXEVENTS))
+    {
+      header = data[iword];
+      if(((header >> 16) & 0xFF) != 0x01)
+	{
+	  tsCheckFormatErrors++;
+	  break;
+	}
+
+      type[nev] = header >> 24;
+      stamp[nev + 1] = ((uint64_t)(data[iword + 3] & 0xFFFF) << 32) |
+	data[iword + 2];
+      nev++;
+
+      iword += 1 + (header & 0xFFFF);
+    }
+
+  if(nev == 0)
+    return;
+
+  /* Intervals, modulo 2^48.  A branch free loop over the block, so the
+     compiler can vectorize it. */
+  for(iev = 0; iev < nev; iev++)
+    {
+      delta[iev] = (stamp[iev + 1] - stamp[iev]) & TSCHECK_MASK48;
+      backwards += (delta[iev] >> 47);
+      wraps += (stamp[iev + 1] < stamp[iev]) & !(delta[iev] >> 47);
+    }
+
+  /* The first event of the run has no previous timestamp */
+  iev = tsCheckHaveLast ? 0 : 1;
+  if(!tsCheckHaveLast)
+    {
+      backwards -= (delta[0] >> 47);
+      wraps -= (stamp[1] < stamp[0]) & !(delta[0] >> 47);
+    }
+
+  for(; iev < nev; iev++)
+    {
+      if(delta[iev] >> 47)
+	continue;
+
+      bin = delta[iev] ? 63 - __builtin_clzll(delta[iev]) : 0;
+      if(bin >= TSCHECK_NBINS)
+	bin = TSCHECK_NBINS - 1;
+      tsCheckHist[type[iev]][bin]++;
+    }
+
+  tsCheckLast = stamp[nev];
+  tsCheckHaveLast = 1;
+  tsCheckEvents += nev;
+  tsCheckWraps += wraps;
+
+  if(backwards)
+    {
+      /* Report the first, then each time the total passes a 1000 */
+      if((tsCheckGlitches == 0) ||
+	 ((tsCheckGlitches + backwards) / 1000 != tsCheckGlitches / 1000))
+	daLogMsg("WARN","Timestamp went backwards (%d in this block, %d total)",
+		 backwards, tsCheckGlitches + backwards);
+      tsCheckGlitches += backwards;
+    }
+}
+
+void
+timestampCheckFprint(FILE *fd)
+{
+  int itype, ibin, used;
+
+  fprintf(fd, "# events %u  glitches %u  wraps %u  format errors %u\n",
+	  tsCheckEvents, tsCheckGlitches, tsCheckWraps, tsCheckFormatErrors);
+  fprintf(fd, "# type  bin  interval_min_ns  count\n");
+
+  for(itype = 0; itype < TSCHECK_NTYPES; itype++)
+    {
+      used = 0;
+      for(ibin = 0; ibin < TSCHECK_NBINS; ibin++)
+	used |= (tsCheckHist[itype][ibin] != 0);
+      if(!used)
+	continue;
+
+      for(ibin = 0; ibin < TSCHECK_NBINS; ibin++)
+	{
+	  if(tsCheckHist[itype][ibin] == 0)
+	    continue;
+	  fprintf(fd, "%4d  %3d  %15llu  %u\n", itype, ibin,
+		  (unsigned long long)(ibin ? (1ULL << ibin) : 0) * TSCHECK_TICK_NS,
+		  tsCheckHist[itype][ibin]);
+	}
+    }
+}
+
+void
+timestampCheckPrint()
+{
+  timestampCheckFprint(stdout);
+}
+
+int
+timestampCheckWrite(char *fname)
+{
+  FILE *fd;
+
+  fd = fopen(fname, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return -1;
+    }
+
+  timestampCheckFprint(fd);
+  fclose(fd);
+
+  return 0;
+}
+
+#endif /* _TIMESTAMPCHECK_INCLUDED */
@@ -0,0 +1,174 @@
+#ifndef _TRANSITIONTIMING_INCLUDED
+#define _TRANSITIONTIMING_INCLUDED
+/* transitionTiming
+
+   Named, nestable timing scopes for the run control transitions.
+
+   void ttTransitionBegin(char *name) - start timing a transition
+   void ttBegin(char *name)           - open a scope inside it
+   void ttEnd()                       - close the innermost scope
+   void ttTransitionEnd()             - close the transition and print
+                                        the breakdown
+   int  ttWrite(char *trend, char *folded)
+                                      - append the last transition to the
+                                        trend file (one line) and, if
+                                        folded is not NULL, to a folded
+                                        stack file for flamegraph.pl
+                                        (self time in us per stack)
+
+   Scopes opened outside of a transition are ignored.
+*/
+#include <time.h>
+
+#define TT_MAXSTEPS  64
+#define TT_MAXDEPTH  8
+
+typedef struct
+{
+  char path[160];   /* "Transition;scope;subscope" */
+  int depth;
+  double ms;        /* including sub-scopes */
+  double selfms;    /* excluding sub-scopes */
+} TT_STEP;
+
+typedef struct
+{
+  int step;         /* index in ttSteps */
+  struct timespec start;
+  double childms;
+} TT_SCOPE;
+
+TT_SCOPE ttStack[TT_MAXDEPTH];
+int ttDepth = -1;     /* -1: no transition being timed */
+
+/* Steps in the order they were opened, the transition itself first */
+TT_STEP ttSteps[TT_MAXSTEPS];
+int ttNsteps = 0;
+
+void
+ttPush(char *name)
+{
+  TT_STEP *step;
+  int len = 0;
+
+  if((ttDepth + 1 >= TT_MAXDEPTH) || (ttNsteps >= TT_MAXSTEPS))
+    return;
+
+  step = &ttSteps[ttNsteps];
+  if(ttDepth >= 0)
+    len = snprintf(step->path, sizeof(step->path), "%s;",
+		   ttSteps[ttStack[ttDepth].step].path);
+  snprintf(&step->path[len], sizeof(step->path) - len, "%s", name);
+  step->depth = ttDepth + 1;
+  step->ms = 0;
+  step->selfms = 0;
+
+  ttDepth++;
+  ttStack[ttDepth].step = ttNsteps++;
+  ttStack[ttDepth].childms = 0;
+  clock_gettime(CLOCK_MONOTONIC, &ttStack[ttDepth].start);
+}
+
+void
+ttBegin(char *name)
+{
+  if(ttDepth < 0)
+    return;  /* outside of a transition */
+
+  ttPush(name);
+}
+
+void
+ttEnd()
+{
+  struct timespec now;
+  TT_STEP *step;
+  double ms;
+
+  if(ttDepth < 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms = 1e3*(now.tv_sec - ttStack[ttDepth].start.tv_sec) +
+    1e-6*(now.tv_nsec - ttStack[ttDepth].start.tv_nsec);
+
+  step = &ttSteps[ttStack[ttDepth].step];
+  step->ms = ms;
+  step->selfms = ms - ttStack[ttDepth].childms;
+
+  ttDepth--;
+  if(ttDepth >= 0)
+    ttStack[ttDepth].childms += ms;
+}
+
+void
+ttTransitionBegin(char *name)
+{
+  ttNsteps = 0;
+  ttDepth = -1;
+  ttPush(name);
+}
+
+void
+ttTransitionEnd()
+{
+  int istep;
+
+  while(ttDepth >= 0)  /* Close any scopes left open */
+    ttEnd();
+
+  if(ttNsteps == 0)
+    return;
+
+  printf("%s: %.2f ms\n", ttSteps[0].path, ttSteps[0].ms);
+  for(istep = 1; istep < ttNsteps; istep++)
+    printf("  %*s%-*s %9.2f ms\n",
+	   2*(ttSteps[istep].depth - 1), "",
+	   40 - 2*(ttSteps[istep].depth - 1),
+	   strrchr(ttSteps[istep].path, ';') + 1, ttSteps[istep].ms);
+}
+
+int
+ttWrite(char *trend, char *folded)
+{
+  time_t now;
+  int istep;
+  FILE *fd;
+
+  if(ttNsteps == 0)
+    return -1;
+
+  fd = fopen(trend, "a");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, trend);
+      return -1;
+    }
+
+  now = time(NULL);
+  fprintf(fd, "%ld %d %s %.2f", (long)now, rol->runNumber, ttSteps[0].path,
+	  ttSteps[0].ms);
+  for(istep = 1; istep < ttNsteps; istep++)
+    fprintf(fd, " %s=%.2f", strchr(ttSteps[istep].path, ';') + 1,
+	    ttSteps[istep].ms);
+  fprintf(fd, "\n");
+  fclose(fd);
+
+  if(folded == NULL)
+    return 0;
+
+  fd = fopen(folded, "a");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, folded);
+      return -1;
+    }
+
+  for(istep = 0; istep < ttNsteps; istep++)
+    fprintf(fd, "%s %.0f\n", ttSteps[istep].path, 1e3*ttSteps[istep].selfms);
+  fclose(fd);
+
+  return 0;
+}
+
+#endif /* _TRANSITIONTIMING_INCLUDED */
@@ -0,0 +1,302 @@
+#ifndef _TRIGGERCAPTURE_INCLUDED
+#define _TRIGGERCAPTURE_INCLUDED
+/* triggerCapture
+
+   Record the TS trigger blocks read out by rocTrigger into a preallocated,
+   memory mapped ring file, and play them back in a later run.
+
+   The file is a TRIGGER_CAPTURE_HEADER page followed by dataWords words
+   of records
+        word 0 : record length in words, including this header
+             1 : event (block) number passed to rocTrigger
+             2 : sync event flag
+           3.. : trigger block, as returned by tsReadTriggerBlock
+   A length of 0 means the next record is at the start of the data area.
+   When the ring is full the oldest records are overwritten; header.tail
+   always points at the oldest complete record.  Writing a record is a
+   memcpy into the mapping, with no system calls.
+
+   int  triggerCaptureOpen(char *fname, int mbytes) - create the file (Prestart)
+   void triggerCaptureBlock(data, nwords, evntno, sync) - append a block
+   void triggerCaptureClose()                       - unmap (End)
+
+   int  triggerReplayOpen(char *fname)   - map a capture for reading
+   int  triggerReplayRead(volatile unsigned int *data, int maxwords, int *sync)
+                                         - tsReadTriggerBlock replacement,
+                                           cycles through the capture.
+                                           Returns the block length and its
+                                           recorded sync flag, or -1 if the
+                                           next record is damaged or longer
+                                           than maxwords.
+   void triggerReplayClose()
+
+   Replay only replaces the data of each block: the TS must still be
+   triggered (pulser) and read out, which paces the replay and sets the
+   CODA sync event marking.  The list's own sync handling follows the
+   recorded flag.
+*/
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TRIGGER_CAPTURE_MAGIC   0x50414354  /* "TCAP" */
+#define TRIGGER_CAPTURE_VERSION 1
+#define TRIGGER_CAPTURE_PAGE    4096
+#define TRIGGER_CAPTURE_RECHDR  3
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t run;
+  uint32_t blockLevel;
+  uint32_t dataWords;   /* size of the data area */
+  uint32_t head;        /* next word to write */
+  uint32_t tail;        /* oldest record */
+  uint32_t nrec;        /* records in the ring */
+  uint32_t nlost;       /* records overwritten */
+} TRIGGER_CAPTURE_HEADER;
+
+void triggerCaptureClose();
+void triggerReplayClose();
+
+TRIGGER_CAPTURE_HEADER *captureHeader = NULL;
+uint32_t *captureData = NULL;
+size_t captureSize = 0;
+
+TRIGGER_CAPTURE_HEADER *replayHeader = NULL;
+uint32_t *replayData = NULL;
+size_t replaySize = 0;
+uint32_t replayPos = 0, replayCount = 0;
+
+/* Map fname.  With create, make a new file of *size bytes */
+void *
+triggerCaptureMap(char *fname, size_t *size, int create)
+{
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(fname, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+  if(fd < 0)
+    {
+      printf("%s: ERROR opening %s\n", __func__, fname);
+      return NULL;
+    }
+
+  if(create)
+    {
+      if(posix_fallocate(fd, 0, *size) != 0)
+	{
+	  printf("%s: ERROR allocating %ld bytes for %s\n",
+		 __func__, (long)*size, fname);
+	  close(fd);
+	  return NULL;
+	}
+    }
+  else
+    {
+      fstat(fd, &st);
+      *size = st.st_size;
+    }
+
+  map = mmap(NULL, *size, create ? (PROT_READ | PROT_WRITE) : PROT_READ,
+	     MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+
+  if(map == MAP_FAILED)
+    {
+      printf("%s: ERROR mapping %s\n", __func__, fname);
+      return NULL;
+    }
+
+  return map;
+}
+
+int
+triggerCaptureOpen(char *fname, int mbytes)
+{
+  triggerCaptureClose();
+
+  captureSize = (size_t)mbytes << 20;
+  if(captureSize <= 2*TRIGGER_CAPTURE_PAGE)
+    return -1;
+
+  captureHeader = (TRIGGER_CAPTURE_HEADER *)triggerCaptureMap(fname, &captureSize, 1);
+  if(captureHeader == NULL)
+    return -1;
+
+  captureData = (uint32_t *)((char *)captureHeader + TRIGGER_CAPTURE_PAGE);
+
+  memset(captureHeader, 0, sizeof(TRIGGER_CAPTURE_HEADER));
+  captureHeader->magic = TRIGGER_CAPTURE_MAGIC;
+  captureHeader->version = TRIGGER_CAPTURE_VERSION;
+  captureHeader->run = rol->runNumber;
+  captureHeader->blockLevel = blockLevel;
+  captureHeader->dataWords = (captureSize - TRIGGER_CAPTURE_PAGE) / 4;
+
+  printf("%s: Capturing trigger blocks to %s (%d MB)\n",
+	 __func__, fname, mbytes);
+
+  return 0;
+}
+
+/* Drop the oldest record */
+void
+triggerCaptureDropTail(TRIGGER_CAPTURE_HEADER *h, uint32_t *data)
+{
+  uint32_t len = data[h->tail];
+
+  if(len == 0)
+    {
+      h->tail = 0;  /* wrap marker */
+      return;
+    }
+
+  h->tail += len;
+  if(h->tail >= h->dataWords)
+    h->tail = 0;
+  h->nrec--;
+  h->nlost++;
+}
+
+void
+triggerCaptureBlock(volatile unsigned int *block, int nwords, int evntno, int sync)
+{
+  TRIGGER_CAPTURE_HEADER *h = captureHeader;
+  uint32_t len, pos;
+
+  if((h == NULL) || (nwords <= 0))
+    return;
+
+  len = nwords + TRIGGER_CAPTURE_RECHDR;
+  if(len > h->dataWords / 2)
+    return;
+
+  pos = h->head;
+  if(pos + len > h->dataWords)
+    {
+      /* Doesn't fit before the end.  Drop the older records up there,
+	 mark the wrap and start over at 0 */
+      while((h->nrec > 0) && (h->tail >= pos))
+	triggerCaptureDropTail(h, captureData);
+      if(pos < h->dataWords)
+	captureData[pos] = 0;
+      pos = 0;
+    }
+
+  /* Make room at pos */
+  while((h->nrec > 0) && (h->tail >= pos) && (h->tail < pos + len))
+    triggerCaptureDropTail(h, captureData);
+
+  captureData[pos] = len;
+  captureData[pos + 1] = evntno;
+  captureData[pos + 2] = sync;
+  memcpy(&captureData[pos + TRIGGER_CAPTURE_RECHDR], (void *)block, nwords*4);
+
+  if(h->nrec == 0)
+    h->tail = pos;
+  h->head = pos + len;
+  h->nrec++;
+}
+
+void
+triggerCaptureClose()
+{
+  if(captureHeader == NULL)
+    return;
+
+  printf("%s: %d blocks captured (%d overwritten)\n",
+	 __func__, captureHeader->nrec, captureHeader->nlost);
+
+  munmap(captureHeader, captureSize);
+  captureHeader = NULL;
+  captureData = NULL;
+}
+
+int
+triggerReplayOpen(char *fname)
+{
+  triggerReplayClose();
+
+  replayHeader = (TRIGGER_CAPTURE_HEADER *)triggerCaptureMap(fname, &replaySize, 0);
+  if(replayHeader == NULL)
+    return -1;
+
+  if((replaySize < 2*TRIGGER_CAPTURE_PAGE) ||
+     (replayHeader->magic != TRIGGER_CAPTURE_MAGIC) ||
+     (replayHeader->version != TRIGGER_CAPTURE_VERSION) ||
+     (replayHeader->nrec == 0) ||
+     (replayHeader->dataWords > (replaySize - TRIGGER_CAPTURE_PAGE) / 4) ||
+     (replayHeader->tail >= replayHeader->dataWords))
+    {
+      printf("%s: ERROR %s is not a usable trigger capture\n", __func__, fname);
+      munmap(replayHeader, replaySize);
+      replayHeader = NULL;
+      return -1;
+    }
+
+  replayData = (uint32_t *)((char *)replayHeader + TRIGGER_CAPTURE_PAGE);
+  replayPos = replayHeader->tail;
+  replayCount = 0;
+
+  printf("%s: Replaying %d blocks from run %d (block level %d)\n",
+	 __func__, replayHeader->nrec, replayHeader->run,
+	 replayHeader->blockLevel);
+
+  return 0;
+}
+
+int
+triggerReplayRead(volatile unsigned int *data, int maxwords, int *sync)
+{
+  uint32_t len;
+
+  if(replayHeader == NULL)
+    return -1;
+
+  /* Back to the oldest record after the last one */
+  if(replayCount == replayHeader->nrec)
+    {
+      replayPos = replayHeader->tail;
+      replayCount = 0;
+    }
+
+  if((replayPos >= replayHeader->dataWords) || (replayData[replayPos] == 0))
+    replayPos = 0;
+
+  /* The file is not trusted: the record must lie inside the data area
+     and its block fit the buffer */
+  len = replayData[replayPos];
+  if((len <= TRIGGER_CAPTURE_RECHDR) ||
+     (len > replayHeader->dataWords - replayPos) ||
+     (len - TRIGGER_CAPTURE_RECHDR > (uint32_t)maxwords))
+    {
+      printf("%s: ERROR bad record at word %d (length %d, at most %d)\n",
+	     __func__, replayPos, len, maxwords + TRIGGER_CAPTURE_RECHDR);
+      return -1;
+    }
+
+  *sync = replayData[replayPos + 2];
+  memcpy((void *)data, &replayData[replayPos + TRIGGER_CAPTURE_RECHDR],
+	 (len - TRIGGER_CAPTURE_RECHDR)*4);
+
+  replayPos += len;
+  replayCount++;
+
+  return len - TRIGGER_CAPTURE_RECHDR;
+}
+
+void
+triggerReplayClose()
+{
+  if(replayHeader == NULL)
+    return;
+
+  munmap(replayHeader, replaySize);
+  replayHeader = NULL;
+  replayData = NULL;
+}
+
+#endif /* _TRIGGERCAPTURE_INCLUDED */
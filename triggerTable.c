@@ -0,0 +1,288 @@
+#ifndef _TRIGGERTABLE_INCLUDED
+#define _TRIGGERTABLE_INCLUDED
+/* triggerTable
+
+   Compile rules that map trigger input combinations to event types into
+   the TS trigger table.
+
+   A rule set is a '+' separated list of rules (';' starts a comment in
+   the user flags file and ',' ends the flag value)
+        <expression>><event type>
+   where the expression is a sum of products of trigger inputs T1..T6:
+        T1&!T4        T1 and not T4
+        T2|T3&T5      T2, or T3 and T5
+   ('&' binds tighter than '|', no parentheses, no spaces).  For example
+        T1&!T4>3+T2|T3>4
+
+   Each of the 63 non-empty input patterns takes the event type of the
+   first rule that matches it.  Patterns that no rule matches keep the
+   default table entry.  Rules must have an event type in 1..255, and
+   products can't ask for an input both set and not set.  Anything after
+   the event type other than '+', an empty rule, or a rule set that ends
+   in '+' rejects the whole set, so that a cut off rule set fails instead
+   of loading part of the table.  A rule that
+   matches no pattern left by the rules before it is reported, since it
+   can never fire.
+
+   int  triggerTableCompile(char *rules) - parse and check, 0 if usable
+   void triggerTableLoad()               - write the compiled patterns
+                                           to the TS (after the default
+                                           table is loaded)
+   void triggerTablePrint()              - dump the compiled table
+*/
+
+#define TRIGTABLE_NINPUTS    6
+#define TRIGTABLE_NPATTERNS  (1 << TRIGTABLE_NINPUTS)
+#define TRIGTABLE_MAXRULES   16
+#define TRIGTABLE_MAXTERMS   8
+#define TRIGTABLE_SEP        '+'  /* between rules */
+
+typedef struct
+{
+  char text[64];
+  int nterms;
+  unsigned int set[TRIGTABLE_MAXTERMS];     /* inputs that must be set */
+  unsigned int clear[TRIGTABLE_MAXTERMS];   /* inputs that must be clear */
+  int type;
+} TRIGTABLE_RULE;
+
+TRIGTABLE_RULE trigTableRules[TRIGTABLE_MAXRULES];
+int trigTableNrules = 0;
+
+/* Compiled table, 0 = default entry */
+int trigTableType[TRIGTABLE_NPATTERNS];
+int trigTableRule[TRIGTABLE_NPATTERNS];
+
+/* Parse one rule from text, up to TRIGTABLE_SEP or the end.  Returns the
+   length used, or -1 with the reason in err */
+int
+triggerTableParseRule(char *text, TRIGTABLE_RULE *rule, char **err)
+{
+  char *pos = text, *end;
+  int input, negate, len;
+
+  memset(rule, 0, sizeof(TRIGTABLE_RULE));
+  len = strcspn(text, "+");
+  snprintf(rule->text, sizeof(rule->text), "%.*s", len, text);
+
+  if(len == 0)
+    {
+      *err = "empty rule";
+      return -1;
+    }
+
+  while(1)
+    {
+      /* One literal of the current product */
+      negate = (*pos == '!');
+      if(negate)
+	pos++;
+
+      if((*pos != 'T') && (*pos != 't'))
+	{
+	  *err = "expected an input T1..T6";
+	  return -1;
+	}
+      input = strtol(pos + 1, &end, 10);
+      if((end == pos + 1) || (input < 1) || (input > TRIGTABLE_NINPUTS))
+	{
+	  *err = "input out of range, expected T1..T6";
+	  return -1;
+	}
+      pos = end;
+
+      if(negate)
+	rule->clear[rule->nterms] |= (1 << (input - 1));
+      else
+	rule->set[rule->nterms] |= (1 << (input - 1));
+
+      if(*pos == '&')
+	{
+	  pos++;
+	  continue;
+	}
+
+      /* End of the product */
+      if(rule->set[rule->nterms] & rule->clear[rule->nterms])
+	{
+	  *err = "a product asks for an input both set and not set";
+	  return -1;
+	}
+      rule->nterms++;
+
+      if(*pos == '|')
+	{
+	  if(rule->nterms >= TRIGTABLE_MAXTERMS)
+	    {
+	      *err = "too many '|' terms";
+	      return -1;
+	    }
+	  pos++;
+	  continue;
+	}
+
+      break;
+    }
+
+  if(*pos != '>')
+    {
+      *err = "expected '>' and an event type";
+      return -1;
+    }
+
+  rule->type = strtol(pos + 1, &end, 0);
+  if(end == pos + 1)
+    {
+      *err = "bad event type";
+      return -1;
+    }
+  if((*end != TRIGTABLE_SEP) && (*end != '\0'))
+    {
+      *err = "unexpected text after the event type";
+      return -1;
+    }
+  if((rule->type < 1) || (rule->type > 255))
+    {
+      *err = "event type out of range 1..255";
+      return -1;
+    }
+
+  return end - text;
+}
+
+int
+triggerTableMatch(TRIGTABLE_RULE *rule, unsigned int pattern)
+{
+  int iterm;
+
+  for(iterm = 0; iterm < rule->nterms; iterm++)
+    if(((pattern & rule->set[iterm]) == rule->set[iterm]) &&
+       ((pattern & rule->clear[iterm]) == 0))
+      return 1;
+
+  return 0;
+}
+
+int
+triggerTableCompile(char *rules)
+{
+  TRIGTABLE_RULE parsed[TRIGTABLE_MAXRULES];
+  char *pos = rules, *err = NULL;
+  int nrules = 0, nread = 0, len, irule, pattern, nnew, nerr = 0;
+
+  memset(trigTableType, 0, sizeof(trigTableType));
+  memset(trigTableRule, 0, sizeof(trigTableRule));
+  trigTableNrules = 0;
+
+  if((rules == NULL) || (*rules == '\0'))
+    return 0;
+
+  while(*pos != '\0')
+    {
+      if(nrules >= TRIGTABLE_MAXRULES)
+	{
+	  daLogMsg("ERROR","Trigger rules: more than %d rules",
+		   TRIGTABLE_MAXRULES);
+	  return -1;
+	}
+
+      nread++;
+      len = triggerTableParseRule(pos, &parsed[nrules], &err);
+      if(len < 0)
+	{
+	  daLogMsg("ERROR","Trigger rule %d '%s': %s",
+		   nread, parsed[nrules].text, err);
+	  nerr++;
+	  len = strcspn(pos, "+");
+	}
+      else
+	nrules++;
+
+      pos += len;
+      if(*pos == TRIGTABLE_SEP)
+	{
+	  pos++;
+	  if(*pos == '\0')
+	    {
+	      daLogMsg("ERROR","Trigger rules end with '%c', cut off?",
+		       TRIGTABLE_SEP);
+	      nerr++;
+	    }
+	}
+    }
+
+  if(nerr)
+    {
+      daLogMsg("ERROR","Trigger rules rejected, using the default trigger table");
+      return -1;
+    }
+
+  /* First matching rule wins */
+  for(irule = 0; irule < nrules; irule++)
+    {
+      nnew = 0;
+      for(pattern = 1; pattern < TRIGTABLE_NPATTERNS; pattern++)
+	{
+	  if(trigTableType[pattern] || !triggerTableMatch(&parsed[irule], pattern))
+	    continue;
+
+	  trigTableType[pattern] = parsed[irule].type;
+	  trigTableRule[pattern] = irule + 1;
+	  nnew++;
+	}
+
+      if(nnew == 0)
+	daLogMsg("WARN","Trigger rule %d '%s' is shadowed by the rules before it",
+		 irule + 1, parsed[irule].text);
+    }
+
+  memcpy(trigTableRules, parsed, nrules*sizeof(TRIGTABLE_RULE));
+  trigTableNrules = nrules;
+
+  return 0;
+}
+
+void
+triggerTableLoad()
+{
+  int pattern;
+
+  for(pattern = 1; pattern < TRIGTABLE_NPATTERNS; pattern++)
+    if(trigTableType[pattern])
+      tsDefineEventType(pattern, 1, trigTableType[pattern]);
+}
+
+void
+triggerTablePrint()
+{
+  int irule, pattern, ibit, nset = 0;
+
+  for(pattern = 1; pattern < TRIGTABLE_NPATTERNS; pattern++)
+    if(trigTableType[pattern])
+      nset++;
+
+  if(nset == 0)
+    {
+      printf("%s: No trigger rules, default trigger table\n", __func__);
+      return;
+    }
+
+  printf("%s: %d rule(s)\n", __func__, trigTableNrules);
+  for(irule = 0; irule < trigTableNrules; irule++)
+    printf("  %2d: %s\n", irule + 1, trigTableRules[irule].text);
+
+  printf("  T654321  type  rule\n");
+  for(pattern = 1; pattern < TRIGTABLE_NPATTERNS; pattern++)
+    {
+      printf("   ");
+      for(ibit = TRIGTABLE_NINPUTS - 1; ibit >= 0; ibit--)
+	printf("%d", (pattern >> ibit) & 1);
+
+      if(trigTableType[pattern])
+	printf("  %4d  %4d\n", trigTableType[pattern], trigTableRule[pattern]);
+      else
+	printf("  default\n");
+    }
+}
+
+#endif /* _TRIGGERTABLE_INCLUDED */
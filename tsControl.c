@@ -0,0 +1,201 @@
+/*************************************************************************
+ *
+ *  tsControl.c - Client of the control socket of the TS readout list
+ *                (controlSocket.c).
+ *
+ *  Usage:  tsControl [-s <socket>] <command> [args]
+ *
+ *    ping                    protocol version and run number
+ *    counters                trigger/block counters, rates and latency
+ *    latency                 rocTrigger latency histogram, non empty bins
+ *    config                  block/buffer level, trigger source, prescales
+ *    coincidence             FP input coincidence matrix and patterns
+ *    inhibit <0|1>           scaler inhibit off/on
+ *    trigsrc <source>        trigger source 0-4 (refused while triggers are on)
+ *    prescale <input> <ps>   prescale of FP input 1-8, at the next block
+ *
+ *    Output is one "name value" pair per line, for scripts.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "controlSocket.h"
+
+#define CONTROL_SOCKET  "/tmp/ts_sbs_list.ctl"
+
+unsigned char data[CONTROL_MAXBYTES];
+
+int
+controlIO(int fd, void *buf, size_t len, int out)
+{
+  char *pos = buf;
+  ssize_t n;
+
+  while(len > 0)
+    {
+      n = out ? write(fd, pos, len) : read(fd, pos, len);
+      if(n <= 0)
+	return -1;
+      pos += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+int
+usage(char *name)
+{
+  printf("Usage: %s [-s <socket>] <command> [args]\n", name);
+  printf("  ping | counters | latency | config | coincidence\n");
+  printf("  inhibit <0|1> | trigsrc <source> | prescale <input> <ps>\n");
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sockaddr_un addr;
+  CONTROL_REQUEST req;
+  CONTROL_REPLY rep;
+  CONTROL_COUNTERS *c = (CONTROL_COUNTERS *)data;
+  CONTROL_CONFIG *cfg = (CONTROL_CONFIG *)data;
+  CONTROL_COINCIDENCE *co = (CONTROL_COINCIDENCE *)data;
+  uint32_t *w = (uint32_t *)data;
+  char *path = CONTROL_SOCKET, *cmd;
+  int iarg = 1, nargs, fd, ibin, jj;
+
+  if((argc > 2) && (strcmp(argv[1], "-s") == 0))
+    {
+      path = argv[2];
+      iarg = 3;
+    }
+  if(iarg >= argc)
+    return usage(argv[0]);
+
+  cmd = argv[iarg];
+  nargs = argc - iarg - 1;
+
+  memset(&req, 0, sizeof(req));
+  req.magic = CONTROL_MAGIC;
+  req.version = CONTROL_VERSION;
+
+  if(strcmp(cmd, "ping") == 0)
+    req.cmd = CONTROL_CMD_PING;
+  else if(strcmp(cmd, "counters") == 0)
+    req.cmd = CONTROL_CMD_COUNTERS;
+  else if(strcmp(cmd, "latency") == 0)
+    req.cmd = CONTROL_CMD_LATENCY;
+  else if(strcmp(cmd, "config") == 0)
+    req.cmd = CONTROL_CMD_CONFIG;
+  else if(strcmp(cmd, "coincidence") == 0)
+    req.cmd = CONTROL_CMD_COINCIDENCE;
+  else if((strcmp(cmd, "inhibit") == 0) && (nargs == 1))
+    req.cmd = CONTROL_CMD_SCALER_INHIBIT;
+  else if((strcmp(cmd, "trigsrc") == 0) && (nargs == 1))
+    req.cmd = CONTROL_CMD_TRIGGER_SOURCE;
+  else if((strcmp(cmd, "prescale") == 0) && (nargs == 2))
+    req.cmd = CONTROL_CMD_PRESCALE;
+  else
+    return usage(argv[0]);
+
+  if(nargs > 0)
+    req.arg[0] = strtol(argv[iarg + 1], NULL, 0);
+  if(nargs > 1)
+    req.arg[1] = strtol(argv[iarg + 2], NULL, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+    {
+      perror(path);
+      return 1;
+    }
+
+  if((controlIO(fd, &req, sizeof(req), 1) != 0) ||
+     (controlIO(fd, &rep, sizeof(rep), 0) != 0) ||
+     (rep.magic != CONTROL_MAGIC) || (rep.nbytes > CONTROL_MAXBYTES) ||
+     (controlIO(fd, data, rep.nbytes, 0) != 0))
+    {
+      fprintf(stderr, "%s: no reply\n", path);
+      close(fd);
+      return 1;
+    }
+  close(fd);
+
+  if(rep.status != CONTROL_OK)
+    {
+      fprintf(stderr, "%s: %s\n", cmd,
+	      (rep.status == CONTROL_EARG) ? "bad argument" :
+	      (rep.status == CONTROL_EREFUSED) ? "refused" : "unknown command");
+      return 1;
+    }
+
+  switch(req.cmd)
+    {
+    case CONTROL_CMD_PING:
+      if(rep.nbytes >= 2*sizeof(uint32_t))
+	printf("version %u\nrun %u\n", w[0], w[1]);
+      break;
+
+    case CONTROL_CMD_COUNTERS:
+      if(rep.nbytes < sizeof(CONTROL_COUNTERS))
+	break;
+      printf("run %u\nactive %u\ntriggers %llu\nblocks %u\n"
+	     "sync_check_errors %u\nseconds %.1f\npeak_rate_hz %.1f\n"
+	     "latency_p50_us %.1f\nlatency_p99_us %.1f\n",
+	     c->run, c->active, (unsigned long long)c->triggers, c->blocks,
+	     c->syncCheckErrors, c->seconds, c->peakRate,
+	     c->latency50, c->latency99);
+      break;
+
+    case CONTROL_CMD_LATENCY:
+      if(rep.nbytes < 2*sizeof(uint32_t))
+	break;
+      printf("# bin_ns %u\n", w[0]);
+      for(ibin = 0; (ibin < (int)w[1]) &&
+	    ((2 + ibin)*sizeof(uint32_t) < rep.nbytes); ibin++)
+	if(w[2 + ibin])
+	  printf("%s%u %u\n", (ibin == (int)w[1] - 1) ? ">" : "",
+		 ibin * w[0], w[2 + ibin]);
+      break;
+
+    case CONTROL_CMD_CONFIG:
+      if(rep.nbytes < sizeof(CONTROL_CONFIG))
+	break;
+      printf("block_level %d\nbuffer_level %d\ntrigger_source %d\n"
+	     "scaler_inhibit %d\n",
+	     cfg->blockLevel, cfg->bufferLevel, cfg->triggerSource,
+	     cfg->scalerInhibit);
+      for(ibin = 0; ibin < 8; ibin++)
+	printf("prescale_t%d %d\n", ibin + 1, cfg->prescale[ibin]);
+      printf("fp_enable 0x%x\nfp_masked 0x%x\nrate_target_hz %d\nntd %d\n",
+	     cfg->fpEnable, cfg->fpMasked, cfg->rateTarget, cfg->nTD);
+      break;
+
+    case CONTROL_CMD_COINCIDENCE:
+      if(rep.nbytes < sizeof(CONTROL_COINCIDENCE))
+	break;
+      printf("events %u\nevents_above_t8 %u\n", co->events, co->other);
+      for(ibin = 0; ibin < 8; ibin++)
+	for(jj = ibin; jj < 8; jj++)
+	  printf("t%d_t%d %u\n", ibin + 1, jj + 1, co->matrix[ibin][jj]);
+      for(ibin = 0; ibin < 256; ibin++)
+	if(co->patterns[ibin])
+	  printf("pattern_0x%02x %u\n", ibin, co->patterns[ibin]);
+      break;
+
+    default:
+      printf("ok\n");
+    }
+
+  return 0;
+}
@@ -0,0 +1,339 @@
+#ifndef _TSTRIGGER_INCLUDED
+#define _TSTRIGGER_INCLUDED
+/* tsTrigger
+
+   Trigger path shared by the TS readout lists.
+
+   tsTriggerPath() is the one implementation.  It is always inlined into
+   the variants below with constant arguments, so each variant is compiled
+   without the branches it doesn't need:
+
+     output  TRIGGER_OUTPUT_NONE    : don't touch the TS output port
+             TRIGGER_OUTPUT_PULSE   : output port bit 0 high during readout
+             TRIGGER_OUTPUT_INHIBIT : rewrite the scaler inhibit bits
+     decode  0 : copy the trigger block only
+             1 : also pass it to the list's rocTriggerDecode()
+     timed   0 : no timing
+             1 : time each phase of the block into tsTriggerPhaseNs[] and
+                 pass the block to the list's rocTriggerTimed()
+     post    0 : nothing after the block
+             1 : call the list's rocTriggerPost() after the block
+
+   The list selects a variant with tsTriggerSelect(output, decode, timed,
+   post) and calls it through rocTriggerPath from rocTrigger.  Each variant
+   returns the number of events in the block.  Work that only comes up
+   now and then, queued by another thread, does not need a post variant
+   for every block: the thread calls tsTriggerWake(), which switches
+   rocTriggerPath to the post variant until rocTriggerPost has run.  The
+   blocks in between pay nothing for it.
+
+   Hooks the including list must define:
+     int  rocTriggerDecode(volatile unsigned int *data, int nwords,
+                           int evntno, int *sync)
+            - inspect or replace the block, return its new length.  A
+              replaced block may also change the sync flag the rest of
+              the path uses
+     void rocTriggerSync(int evntno)
+            - sync event processing after the block level check
+     void rocTriggerPost(int evntno, volatile unsigned int *block, int timed)
+            - work after the block (post variants), with the event
+              starting at block and dma_dabufp at its end.  timed variants may
+              charge parts of it to their own phase with
+              tsTriggerPhaseMark(); the rest goes to TRIGGER_PHASE_POST
+     void rocTriggerTimed(int evntno, unsigned int ns,
+                          volatile unsigned int *block, int nwords)
+            - the block took ns, with the phase times in tsTriggerPhaseNs[]
+              (timed variants)
+
+   Define DEBUGSYNCEVENT to print the first words of sync event blocks.
+   Define FAULT_INJECT to build in the faults of faultInject.c.
+*/
+#include <string.h>
+#include <time.h>
+#include "faultInject.c"
+
+#define TRIGGER_OUTPUT_NONE     0
+#define TRIGGER_OUTPUT_PULSE    1
+#define TRIGGER_OUTPUT_INHIBIT  2
+#define TRIGGER_OUTPUT_MODES    3
+
+/* Phases timed by the timed variants */
+#define TRIGGER_PHASE_OUTPUT    0   /* output port writes */
+#define TRIGGER_PHASE_DMA       1   /* tsReadTriggerBlock */
+#define TRIGGER_PHASE_DECODE    2   /* rocTriggerDecode */
+#define TRIGGER_PHASE_SYNC      3   /* sync event handling */
+#define TRIGGER_PHASE_POST      4   /* rest of rocTriggerPost */
+#define TRIGGER_PHASE_MODULES   5   /* crate module readout */
+#define TRIGGER_PHASE_CONTROL   6   /* control socket changes */
+#define TRIGGER_PHASE_RATECTL   7   /* rate controller changes */
+#define TRIGGER_NPHASES         8
+
+char *tsTriggerPhaseNames[TRIGGER_NPHASES] =
+  {
+   "output",
+   "dma",
+   "decode",
+   "sync",
+   "post",
+   "modules",
+   "control",
+   "ratectl"
+  };
+
+/* Phase times (ns) and sync flag of the last block, timed variants only */
+unsigned int tsTriggerPhaseNs[TRIGGER_NPHASES];
+unsigned long long tsTriggerPhaseT = 0;   /* start of the current phase */
+int tsTriggerLastSync = 0;
+
+/* Defined by lists that drive the scaler inhibit from the output port */
+extern int scaler_inhibit;
+
+int rocTriggerDecode(volatile unsigned int *data, int nwords, int evntno, int *sync);
+void rocTriggerSync(int evntno);
+void rocTriggerPost(int evntno, volatile unsigned int *block, int timed);
+void rocTriggerTimed(int evntno, unsigned int ns,
+		     volatile unsigned int *block, int nwords);
+
+typedef int (*TRIGGER_PATH)(int evntno);
+
+static inline unsigned long long
+tsTriggerNs()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return (unsigned long long)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+/* Charge the time since the last mark to phase (timed variants, hooks) */
+void
+tsTriggerPhaseMark(int phase)
+{
+  unsigned long long now = tsTriggerNs();
+
+  tsTriggerPhaseNs[phase] += now - tsTriggerPhaseT;
+  tsTriggerPhaseT = now;
+}
+
+#define TRIGGER_PHASE_MARK(phase)				\
+  if(timed)							\
+    tsTriggerPhaseMark(phase);
+
+int tsTriggerPulse(int evntno);
+int tsTriggerPulsePost(int evntno);
+
+TRIGGER_PATH rocTriggerPath = tsTriggerPulse;
+TRIGGER_PATH tsTriggerBasePath = tsTriggerPulse;
+TRIGGER_PATH tsTriggerPostPath = tsTriggerPulsePost;
+volatile int tsTriggerPending = 0;
+
+/*
+  Post variants: take the pending work and go back to the base variant
+  before running it.  A wake that comes in meanwhile switches back.
+*/
+static inline void
+tsTriggerPostBegin()
+{
+  __atomic_store_n(&tsTriggerPending, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&rocTriggerPath, tsTriggerBasePath, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+tsTriggerPostEnd()
+{
+  if(__atomic_load_n(&tsTriggerPending, __ATOMIC_SEQ_CST))
+    __atomic_store_n(&rocTriggerPath, tsTriggerPostPath, __ATOMIC_SEQ_CST);
+}
+
+/* From any thread: run rocTriggerPost after the next block */
+void
+tsTriggerWake()
+{
+  __atomic_store_n(&tsTriggerPending, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&rocTriggerPath, tsTriggerPostPath, __ATOMIC_SEQ_CST);
+}
+
+static inline __attribute__((always_inline)) int
+tsTriggerPath(int evntno, const int output, const int decode, const int timed,
+	      const int post)
+{
+  int stat, dCnt, idata, nevents = 0;
+  volatile unsigned int *block = dma_dabufp;
+  unsigned long long tstart = 0;
+#ifdef FAULT_INJECT
+  unsigned long long tfault = tsTriggerNs();
+  int complete = 0;
+#endif
+
+  if(timed)
+    {
+      memset(tsTriggerPhaseNs, 0, sizeof(tsTriggerPhaseNs));
+      tstart = tsTriggerPhaseT = tsTriggerNs();
+    }
+
+  /* Check if this is a Sync Event */
+  stat = FAULT_SYNC_FLAG(syncFlag);
+  if(stat) {
+    printf("rocTrigger: Got Sync Event!! Block # = %d\n",evntno);
+    usrDebugFlag=0;
+  }
+  /* Set Output port bit 0  */
+  if(output == TRIGGER_OUTPUT_PULSE)
+    tsSetOutputPort(1,0,0,0,0,0);
+  if(output == TRIGGER_OUTPUT_INHIBIT)
+    tsSetOutputPort(0,0,scaler_inhibit,scaler_inhibit,0,0);
+  TRIGGER_PHASE_MARK(TRIGGER_PHASE_OUTPUT);
+
+  /* Readout the trigger block from the TS
+     Trigger Block MUST be reaodut first */
+  dCnt = FAULT_TS_READ(dma_dabufp);
+  TRIGGER_PHASE_MARK(TRIGGER_PHASE_DMA);
+  if(dCnt<=0)
+    {
+      logMsg("No data or error.  dCnt = %d\n",dCnt);
+    }
+  else
+    { /* TS Data is already in a bank structure.  Bump the pointer */
+      if(decode)
+	{
+	  dCnt = rocTriggerDecode(dma_dabufp, dCnt, evntno, &stat);
+	  TRIGGER_PHASE_MARK(TRIGGER_PHASE_DECODE);
+	}
+
+#ifdef DEBUGSYNCEVENT
+      if(stat) {
+	printf("rocTrigger: Sync Event data: 0x%08x 0x%08x 0x%08x 0x%08x\n",
+	       *dma_dabufp, *(dma_dabufp+1), *(dma_dabufp+2), *(dma_dabufp+3));
+      }
+#endif
+      nevents = dma_dabufp[1] & 0xFF;
+#ifdef FAULT_INJECT
+      complete = (dma_dabufp[0] + 1 == (unsigned int)dCnt) &&
+	(nevents == blockLevel);
+#endif
+      dma_dabufp += dCnt;
+    }
+  if(timed)
+    tsTriggerLastSync = stat;
+
+  if(stat) {
+    /* Set new block level if it has changed */
+    idata = FAULT_BLOCKLEVEL_READ(tsGetCurrentBlockLevel());
+    if((idata != blockLevel)&&(idata<255)) {
+      blockLevel = idata;
+      printf("rocTrigger: Block Level changed to %d\n",blockLevel);
+    }
+
+    rocTriggerSync(evntno);
+    TRIGGER_PHASE_MARK(TRIGGER_PHASE_SYNC);
+  }
+
+#ifdef FAULT_INJECT
+  faultInjectTag(evntno);
+#endif
+
+  /* Clear output register bit 0 */
+  if(output == TRIGGER_OUTPUT_PULSE)
+    tsSetOutputPort(0,0,0,0,0,0);
+  TRIGGER_PHASE_MARK(TRIGGER_PHASE_OUTPUT);
+
+  if(post)
+    {
+      tsTriggerPostBegin();
+      rocTriggerPost(evntno, block, timed);
+      TRIGGER_PHASE_MARK(TRIGGER_PHASE_POST);
+      tsTriggerPostEnd();
+    }
+
+  if(timed)
+    rocTriggerTimed(evntno, (unsigned int)(tsTriggerPhaseT - tstart),
+		    block, dma_dabufp - block);
+
+#ifdef FAULT_INJECT
+  faultInjectBlockDone(tsTriggerNs() - tfault, complete, stat);
+#endif
+
+  return nevents;
+}
+
+/* Variants: output mode, decode, timed, post */
+#define TRIGGER_VARIANT(name, output, decode, timed, post)		\
+  int name(int evntno)							\
+  { return tsTriggerPath(evntno, output, decode, timed, post); }
+
+TRIGGER_VARIANT(tsTriggerNone,                   TRIGGER_OUTPUT_NONE,    0, 0, 0)
+TRIGGER_VARIANT(tsTriggerNoneDecode,             TRIGGER_OUTPUT_NONE,    1, 0, 0)
+TRIGGER_VARIANT(tsTriggerPulse,                  TRIGGER_OUTPUT_PULSE,   0, 0, 0)
+TRIGGER_VARIANT(tsTriggerPulseDecode,            TRIGGER_OUTPUT_PULSE,   1, 0, 0)
+TRIGGER_VARIANT(tsTriggerInhibit,                TRIGGER_OUTPUT_INHIBIT, 0, 0, 0)
+TRIGGER_VARIANT(tsTriggerInhibitDecode,          TRIGGER_OUTPUT_INHIBIT, 1, 0, 0)
+TRIGGER_VARIANT(tsTriggerNoneTimed,              TRIGGER_OUTPUT_NONE,    0, 1, 0)
+TRIGGER_VARIANT(tsTriggerNoneDecodeTimed,        TRIGGER_OUTPUT_NONE,    1, 1, 0)
+TRIGGER_VARIANT(tsTriggerPulseTimed,             TRIGGER_OUTPUT_PULSE,   0, 1, 0)
+TRIGGER_VARIANT(tsTriggerPulseDecodeTimed,       TRIGGER_OUTPUT_PULSE,   1, 1, 0)
+TRIGGER_VARIANT(tsTriggerInhibitTimed,           TRIGGER_OUTPUT_INHIBIT, 0, 1, 0)
+TRIGGER_VARIANT(tsTriggerInhibitDecodeTimed,     TRIGGER_OUTPUT_INHIBIT, 1, 1, 0)
+TRIGGER_VARIANT(tsTriggerNonePost,               TRIGGER_OUTPUT_NONE,    0, 0, 1)
+TRIGGER_VARIANT(tsTriggerNoneDecodePost,         TRIGGER_OUTPUT_NONE,    1, 0, 1)
+TRIGGER_VARIANT(tsTriggerPulsePost,              TRIGGER_OUTPUT_PULSE,   0, 0, 1)
+TRIGGER_VARIANT(tsTriggerPulseDecodePost,        TRIGGER_OUTPUT_PULSE,   1, 0, 1)
+TRIGGER_VARIANT(tsTriggerInhibitPost,            TRIGGER_OUTPUT_INHIBIT, 0, 0, 1)
+TRIGGER_VARIANT(tsTriggerInhibitDecodePost,      TRIGGER_OUTPUT_INHIBIT, 1, 0, 1)
+TRIGGER_VARIANT(tsTriggerNoneTimedPost,          TRIGGER_OUTPUT_NONE,    0, 1, 1)
+TRIGGER_VARIANT(tsTriggerNoneDecodeTimedPost,    TRIGGER_OUTPUT_NONE,    1, 1, 1)
+TRIGGER_VARIANT(tsTriggerPulseTimedPost,         TRIGGER_OUTPUT_PULSE,   0, 1, 1)
+TRIGGER_VARIANT(tsTriggerPulseDecodeTimedPost,   TRIGGER_OUTPUT_PULSE,   1, 1, 1)
+TRIGGER_VARIANT(tsTriggerInhibitTimedPost,       TRIGGER_OUTPUT_INHIBIT, 0, 1, 1)
+TRIGGER_VARIANT(tsTriggerInhibitDecodeTimedPost, TRIGGER_OUTPUT_INHIBIT, 1, 1, 1)
+
+TRIGGER_PATH tsTriggerPaths[2][2][TRIGGER_OUTPUT_MODES][2] =
+  {
+   {
+    {
+     { tsTriggerNone, tsTriggerNoneDecode },
+     { tsTriggerPulse, tsTriggerPulseDecode },
+     { tsTriggerInhibit, tsTriggerInhibitDecode }
+    },
+    {
+     { tsTriggerNoneTimed, tsTriggerNoneDecodeTimed },
+     { tsTriggerPulseTimed, tsTriggerPulseDecodeTimed },
+     { tsTriggerInhibitTimed, tsTriggerInhibitDecodeTimed }
+    }
+   },
+   {
+    {
+     { tsTriggerNonePost, tsTriggerNoneDecodePost },
+     { tsTriggerPulsePost, tsTriggerPulseDecodePost },
+     { tsTriggerInhibitPost, tsTriggerInhibitDecodePost }
+    },
+    {
+     { tsTriggerNoneTimedPost, tsTriggerNoneDecodeTimedPost },
+     { tsTriggerPulseTimedPost, tsTriggerPulseDecodeTimedPost },
+     { tsTriggerInhibitTimedPost, tsTriggerInhibitDecodeTimedPost }
+    }
+   }
+  };
+
+/* post = 1 runs rocTriggerPost after every block, 0 only after a wake */
+void
+tsTriggerSelect(int output, int decode, int timed, int post)
+{
+  if((output < 0) || (output >= TRIGGER_OUTPUT_MODES))
+    output = TRIGGER_OUTPUT_NONE;
+
+  timed = timed ? 1 : 0;
+  decode = decode ? 1 : 0;
+
+  tsTriggerBasePath = tsTriggerPaths[post ? 1 : 0][timed][output][decode];
+  tsTriggerPostPath = tsTriggerPaths[1][timed][output][decode];
+  tsTriggerPending = 0;
+  __atomic_store_n(&rocTriggerPath, tsTriggerBasePath, __ATOMIC_SEQ_CST);
+
+  printf("%s: output mode %d, %s, %s, %s\n", __func__, output,
+	 decode ? "with decoding" : "no decoding",
+	 timed ? "timed" : "not timed",
+	 post ? "post every block" : "post on wake");
+}
+
+#endif /* _TSTRIGGER_INCLUDED */
@@ -19,7 +19,11 @@
 /* Define Interrupt source and address */
 #define TS_READOUT TS_READOUT_EXT_POLL  /* Poll for available data, external triggers */
 /* #define TS_ADDR    (20<<19)           GEO slot 20  for ELMA backplane*/
-#define TS_ADDR  0                 /* 0 for Autoscan for TS */
+/* #define TS_ADDR  0                 0 for Autoscan for TS */
+#define TS_ADDR  slotCacheTSAddr()  /* Slot from the VME slot cache, 0 to Autoscan */
+unsigned int slotCacheTSAddr();
+#define TS_FLAG  warmDownloadTSFlag()  /* No init for a warm Download */
+int warmDownloadTSFlag();
 
 
 /* make useful TD library variables available*/
@@ -27,9 +31,9 @@ extern int tdID[21];
 extern int nTD;
 
 #define SCALERS 1
-#ifdef SCALERS
+
+/* Scaler inhibit bits of the output port (tsTrigger.c) */
 int scaler_inhibit=0;
-#endif
 
 #include "dmaBankTools.h"
 #include "tsprimary_list.c" /* source required for CODA */
@@ -39,9 +43,36 @@ int scaler_inhibit=0;
 /* Library to pipe stdout to daLogMsg */
 #include "dalmaRolLib.h"
 
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
 #include "usrstrutils.c"
 
+/* TS busy transition recorder */
+#include "busyTrace.c"
+
+/* Trigger block capture to, and replay from, a memory mapped file */
+#include "triggerCapture.c"
+#include "rateSeries.c"
+
+/* 48 bit timestamp check and trigger interval histograms */
+#include "timestampCheck.c"
+#include "triggerTable.c"
+#include "coincidence.c"
+
+/* Timing of the steps of each transition */
+#include "transitionTiming.c"
+#include "cycleTrack.c"
+
+/* Local control and query socket, see tsControl */
+#include "controlSocket.c"
+#define CONTROL_SOCKET  "/tmp/ts_sbs_list.ctl"
+
 #define BLOCKLEVEL  1
+/* Limits for the adaptive block level ('autoblocklevel' user flag) */
+#define MAX_AUTO_BLOCKLEVEL  40
+#define TARGET_BLOCK_RATE    2000   /* Hz */
 /* override this setting with 'bufferlevel' user string */
 #define BUFFERLEVEL 5
 #define SYNC_INTERVAL 10000
@@ -63,6 +94,8 @@ int scaler_inhibit=0;
       0 : external inputs
       1 : internal random pulser
       2 : internal fixed rate pulser
+      3 : trigger holdoff calibration (random pulser sweep)
+      4 : throughput sweep (random and fixed rate pulser schedule)
 
   Set with rocSetTriggerSource(int source);
 */
@@ -72,6 +105,16 @@ void rocSetTriggerSource(int source); // routine prototype
 /* Global Flag for debug printing */
 int usrDebugFlag=0;
 
+/* Trigger path variants shared with the other TS lists */
+#include "tsTrigger.c"
+#include "blockBudget.c"
+#include "crateModules.c"
+#ifdef SCALERS
+#define TRIGGER_OUTPUT TRIGGER_OUTPUT_INHIBIT
+#else
+#define TRIGGER_OUTPUT TRIGGER_OUTPUT_PULSE
+#endif
+
 /*
   Hardcode ROC names to their TD ports
   -- someday (tm) read them in with a config file - BM 10sept21
@@ -128,10 +171,560 @@ TD_SLAVE_MAP tdSlaveConfig[nSlaves] =
   };
 
 
+/*
+  Adaptive block level controller
+    autoblocklevel=0 : (default) use BLOCKLEVEL
+    autoblocklevel=1 : choose the block level at Prestart from the previous
+                       run's trigger rate and ROC busy fractions
+    autoblocklevel=2 : as 1, and also re-evaluate at sync events during the run,
+                       keeping the busy correction made at Prestart.
+                       A new level is only requested at a sync event where
+                       the TS has no block waiting and every enabled ROC has
+                       read out all blocks up to it (from the counters
+                       latched for the sync check), otherwise at the next
+                       one.  The TS applies it at the following sync event;
+                       each change is kept with its first block in the run
+                       report, and logged by the sync event thread.
+    maxblocklevel    : upper limit   (default MAX_AUTO_BLOCKLEVEL)
+    targetblockrate  : block rate (Hz) the controller aims for
+                       (default TARGET_BLOCK_RATE)
+*/
+
+/* TD busy counters tick in units of this many ns */
+#define TD_BUSY_TICK_NS  7680.
+
+int autoBlockLevel = 0;
+int maxBlockLevel = MAX_AUTO_BLOCKLEVEL;
+int targetBlockRate = TARGET_BLOCK_RATE;
+int autoBlockLevelRequest = 0;    /* level waiting for the TDs to drain */
+int autoBlockLevelWaited = 0;     /* sync events it has waited */
+double autoBlockLevelBusy = 0;    /* max ROC busy fraction used at Prestart */
+
+/* Block level in force from block 'evntno' on, for the run report */
+#define BLOCKLEVEL_HISTORY  64
+typedef struct
+{
+  int evntno;
+  int level;
+} BLOCKLEVEL_CHANGE;
+
+BLOCKLEVEL_CHANGE blockLevelHistory[BLOCKLEVEL_HISTORY];
+int nBlockLevelHistory = 0;                    /* __atomic */
+
+/* Block levels requested at sync events, for the sync event thread to log */
+typedef struct
+{
+  int evntno;
+  int level;
+  int waited;     /* sync events spent waiting for the TDs to drain */
+  double rate;
+} BLOCKLEVEL_REQUEST;
+
+BLOCKLEVEL_REQUEST blockLevelRequests[BLOCKLEVEL_HISTORY];
+int nBlockLevelRequests = 0;                   /* __atomic */
+
+/* Measurements from the previous run, filled at End */
+struct timespec runGoTime, runEndTime, lastSyncTime;
+unsigned long long lastSyncTriggers = 0;
+double syncTrigRate = 0;          /* over the last sync interval */
+double lastRunTrigRate = 0;
+double rocBusyFraction[nSlaves];
+
+/* Where run summaries are written */
+#define SBS_RUNINFO_DIR    "/adaqfs/home/sbs-onl/runinfo"
+
+/*
+  Trigger holdoff calibration  (rocTriggerSource = 3)
+    Sweep the rule 1 holdoff window over holdoffCalWindow[] at each random
+    pulser rate in holdoffCalRate[].  The smallest window that shows no
+    front-end busy at any rate is written to 'holdoffcalfile' as a
+    'holdoff=N' line, ready to paste into the user flags file, and is
+    left in rule 1 for the rest of the run.  If none is found, or the run
+    ends first, rule 1 goes back to the window it had before the sweep.
+    A step counts as busy above 'holdoffcalbusy' (ROC busy fraction,
+    default HOLDOFF_CAL_BUSY).
+*/
+#define HOLDOFF_CAL_FILE   "/adaqfs/home/sbs-onl/prescale/holdoff_cal.dat"
+#define HOLDOFF_CAL_DWELL  2        /* seconds per step */
+#define HOLDOFF_CAL_BUSY   0.001    /* ROC busy fraction counted as busy */
+
+int holdoffCalWindow[] = { 5, 10, 15, 20, 25, 30, 40, 50, 60 };
+int holdoffCalRate[]   = { 6, 5, 4 };  /* RANDOM_RATE codes */
+double holdoffCalBusy = HOLDOFF_CAL_BUSY;
+#define NHOLDOFF_CAL_WINDOW (int)(sizeof(holdoffCalWindow)/sizeof(int))
+#define NHOLDOFF_CAL_RATE   (int)(sizeof(holdoffCalRate)/sizeof(int))
+
+/* rule 1 holdoff from the 'holdoff' user flag (0 = use the Download value) */
+int holdoffWindow = 0;
+
+/*
+  Throughput sweep  (rocTriggerSource = 4)
+    Step the random pulser through rate codes 7..0, then the fixed rate
+    pulser through throughputSweepPeriod[] (tsSoftTrig period_inc, see
+    rocGo).  At End the rate vs livetime curve, with the busy fraction of
+    each enabled ROC, is written as CSV to 'sweepfile'
+    (default THROUGHPUT_SWEEP_FILE, a single %d is the run number).
+*/
+#define THROUGHPUT_SWEEP_FILE   SBS_RUNINFO_DIR "/throughput_sweep_%d.csv"
+#define THROUGHPUT_SWEEP_DWELL  5    /* seconds per step */
+#define NRANDOM_RATE            8
+
+int throughputSweepPeriod[] = { 2000, 1000, 500, 200, 100, 50, 20, 10 };
+#define NTHROUGHPUT_SWEEP_PERIOD (int)(sizeof(throughputSweepPeriod)/sizeof(int))
+#define NTHROUGHPUT_SWEEP (NRANDOM_RATE + NTHROUGHPUT_SWEEP_PERIOD)
+
+/* One step of a pulser sweep */
+typedef struct
+{
+  double seconds;
+  unsigned int blocks;
+  double livetime;
+  double busy[nSlaves];
+  double maxBusy;
+  int worst;
+} SWEEP_STEP;
+
+SWEEP_STEP throughputSweep[NTHROUGHPUT_SWEEP];
+int nThroughputSweep = 0;
+
+/* Background thread that runs either pulser sweep */
+pthread_t sweepThread;
+volatile int sweepRunning = 0;
+
+/*
+  Fiber link pre-flight at Prestart
+    Every enabled tdSlaveConfig port must have its fiber link up and its
+    trigger source enabled.  Problem ports are always reported; with
+    'dropdeadrocs' they are also removed from the slave configuration.
+*/
+int dropDeadRocs = 0;
+
+/*
+  Stuck readout watchdog
+    A thread started at Go checks the readout block count every
+    WATCHDOG_PERIOD seconds.  If it has not moved for WATCHDOG_STALL
+    seconds while the TS reports busy, the TS busy sources, the fiber
+    masks and busy counters of each TD, and the block counters are saved
+    in watchdogRing[] and the ROC most likely holding busy is named with
+    daLogMsg.  Disable with 'watchdog=0'.  watchdogPrint() dumps the ring.
+*/
+#define WATCHDOG_PERIOD  1   /* seconds */
+#define WATCHDOG_STALL   5   /* seconds */
+#define WATCHDOG_RING    16
+#define TD_NPORTS        8
+
+typedef struct
+{
+  int slot;
+  unsigned int linkMask;
+  unsigned int trigSrcMask;
+  unsigned int busy[TD_NPORTS];
+} WATCHDOG_TD;
+
+typedef struct
+{
+  time_t time;
+  unsigned int blocks;
+  int bready;
+  unsigned int tsBusy;
+  int culprit;            /* tdSlaveConfig index, -1 if unknown */
+  WATCHDOG_TD td[21];
+} WATCHDOG_SNAPSHOT;
+
+WATCHDOG_SNAPSHOT watchdogRing[WATCHDOG_RING];
+int watchdogCount = 0;  /* snapshots taken since Download */
+int watchdogEnable = 1;
+
+pthread_t watchdogThread;
+volatile int watchdogRunning = 0;
+
+/*
+  Sync event consistency check  (on unless 'synccheck=0')
+    The counter reads are done in the trigger path, by rocTriggerSync,
+    once per sync event: the TS trigger counter, tsBReady (for the TS
+    block count, blocks read out + blocks waiting in the TS) and one
+    tdGetBlockCounter per enabled TD slave port.  A thread can't do
+    them: the TS and TD counters keep moving while it polls, so its
+    values would not belong to the same moment as the sync event.  The
+    block level controller (autoblocklevel) uses the same latched
+    values.  Only the checks and the reports run on the thread:
+      - sync events are SYNC_INTERVAL blocks apart (no missed blocks)
+      - the TS has counted at least the triggers read out so far
+      - every enabled ROC has acknowledged the TS block count, to within
+        its buffer level (+ SYNCCHECK_SLACK blocks in flight)
+    A ROC out of line at two sync events in a row is reported with its
+    TD slot/port, and again when it recovers.
+*/
+#define SYNCCHECK_POLL_US  100000
+#define SYNCCHECK_SLACK    2
+
+typedef struct
+{
+  int evntno;                      /* block number of the sync event */
+  unsigned long long triggers;     /* read out before it */
+  unsigned long long tsTriggers;   /* TS trigger counter */
+  unsigned int tsBlocks;           /* TS block count */
+  unsigned int rocBlocks[nSlaves]; /* TD block counters, enabled ports */
+} SYNCCHECK_LATCH;
+
+int syncCheckEnable = 1;
+volatile unsigned int syncCheckSeq = 0;    /* odd while the latch is written */
+SYNCCHECK_LATCH syncCheckLatch;
+unsigned int syncCheckErrors = 0;
+int syncCheckBad[nSlaves];                 /* consecutive bad sync events */
+
+pthread_t syncCheckThread;
+volatile int syncCheckRunning = 0;
+
+/*
+  Busy transition trace
+    busytrace=N : sample the TS busy status every N us from Go to End
+                  and write the transitions to BUSYTRACE_FILE at End.
+                  busyTraceSave() writes the file on demand.
+                  N below BUSYTRACE_SPIN_US keeps a CPU core spinning;
+                  each sample holds the TS library lock for two reads.
+*/
+#define BUSYTRACE_FILE  SBS_RUNINFO_DIR "/busytrace_%d.bin"
+int busyTraceUs = 0;
+
+/*
+  Trigger block capture and replay
+    capture=N       : copy every trigger block into an N MB ring file
+    capturefile=... : capture file (default TRIGGER_CAPTURE_FILE,
+                      a single %d is the run number)
+    replay=...      : replace each trigger block with the next one from
+                      this capture file.  Use with a pulser trigger
+                      source; the block level is taken from the capture,
+                      and sync handling follows the recorded sync flags.
+                      A damaged record stops the replay; the live blocks
+                      are kept from there on.
+*/
+#define TRIGGER_CAPTURE_FILE  SBS_RUNINFO_DIR "/trigcapture_%d.dat"
+int captureMB = 0;
+
+/*
+  Timestamp check
+    tscheck : check the timestamps of every trigger block and histogram
+              the trigger intervals by event type.  A summary is printed
+              at each sync event, timestampCheckPrint() prints the
+              histograms, and they are written to TSCHECK_FILE at End.
+*/
+#define TSCHECK_FILE  SBS_RUNINFO_DIR "/timestamps_%d.txt"
+int tsCheckEnable = 0;
+
+/*
+  FP input coincidences
+    coincidence : accumulate the pattern of T1-T8 of every event, for the
+              pairwise overlap of the trigger inputs.  Read it during the
+              run with coincidencePrint() or 'tsControl coincidence'; it is
+              written to COINC_FILE at End.
+*/
+#define COINC_FILE  SBS_RUNINFO_DIR "/coincidence_%d.txt"
+int coincEnable = 0;
+
+/*
+  Rate series
+    rateseries=<ms> : every <ms> (default 100) from Go to End, sample the
+              block and trigger counts, accepted triggers per FP input,
+              livetime, busy fraction of each ROC and TS blocks ready into
+              RATESERIES_FILE.  The file grows with the run, up to a run of
+              'rateserieshours' (default RATESERIES_HOURS).  Export it with
+              rateSeriesCsv.
+*/
+#define RATESERIES_FILE   SBS_RUNINFO_DIR "/rateseries_%d.bin"
+#define RATESERIES_HOURS  12
+int rateSeriesMs = 0;
+int rateSeriesHours = RATESERIES_HOURS;
+unsigned int rateSeriesBusy[nSlaves];   /* TD busy counters at the last sample */
+
+/*
+  End of run report
+    Written as JSON to RUNREPORT_FILE (%d is the run number) at End:
+    blocks, triggers, duration, average and peak trigger rate, livetime,
+    busy fraction of each enabled ROC, the trigger configuration, and
+    percentiles of the rocTrigger latency.
+*/
+#define RUNREPORT_FILE  SBS_RUNINFO_DIR "/runreport_%d.json"
+
+/* rocTrigger latency histogram, last bin is overflow */
+#define LATENCY_BIN_NS  100
+#define LATENCY_NBINS   10000
+unsigned int readoutLatency[LATENCY_NBINS + 1];
+unsigned long long runTriggers = 0;
+double peakTrigRate = 0;
+
+/*
+  Readout time budget
+    blockbudget=<us> : count the blocks that take longer than <us> in
+              rocTrigger, by their slowest phase and sync/normal, and keep
+              the slowest blocks with their trigger bank headers.  The
+              crate module readout and the control socket and rate
+              controller changes made between blocks have their own
+              phases.  blockBudgetPrint() prints the summary, and it is
+              written to BLOCKBUDGET_FILE at End.
+*/
+#define BLOCKBUDGET_FILE  SBS_RUNINFO_DIR "/blockbudget_%d.txt"
+int blockBudgetUs = 0;
+
+#ifdef FAULT_INJECT
+/*
+  Fault injection  (built with -DFAULT_INJECT, see faultInject.c)
+    faults=<mask>  : FAULT_* bits to inject
+    faultrate=<N>  : block faults on about 1 in N blocks (default 1000)
+    The cost and recovery time of each fault are written to FAULT_FILE at
+    End.  faultInjectPrint() prints them during the run.  Faulted blocks
+    carry a FAULT_BANK bank in the data.
+*/
+#define FAULT_FILE  SBS_RUNINFO_DIR "/faults_%d.txt"
+int faultFlagMask = 0, faultFlagRate = 1000;
+#endif
+
+/*
+  In-crate modules
+    modules=<type>:<args>+... : extra VME modules in the TS crate, read out
+              after the trigger block into their own banks (see
+              crateModules.c), e.g. 'modules=fifo:0x08000000/32'.
+              They are initialized at Prestart.  Their data is limited to
+              the room left in the event (MAX_EVENT_LENGTH).
+*/
+char crateModuleList[256];
+
+/*
+  Trigger table rules
+    trigrules=<rules> : event types for trigger input combinations, e.g.
+              'trigrules=T1&!T4>3+T2|T3>4' (see triggerTable.c).  The rules
+              are checked when the flags are read and loaded over the
+              default trigger table at Prestart.  Rejected rules leave the
+              default table, which Prestart reports as an ERROR.
+              triggerTablePrint() dumps the result.
+*/
+int trigRulesOK = 1;    /* 0: the trigrules flag was rejected */
+
+/*
+  Transition timing
+    The steps of Download, Prestart, Go and End are timed with
+    transitionTiming scopes.  The breakdown is printed after each
+    transition and appended to TT_TREND_FILE.  With 'ttfolded' it is also
+    appended to TT_FOLDED_FILE, in folded stack format for flamegraph.pl.
+*/
+#define TT_TREND_FILE   SBS_RUNINFO_DIR "/transitions.log"
+#define TT_FOLDED_FILE  SBS_RUNINFO_DIR "/transitions.folded"
+int ttFolded = 0;
+
+/*
+  Run cycle tracking
+    At each End, the resident memory, heap in use, open files and the time
+    of the transitions since the last End are appended to CYCLE_FILE, and
+    a steady rise of any of them over the last runs is logged (see
+    cycleTrack.c).
+*/
+#define CYCLE_FILE  SBS_RUNINFO_DIR "/cycles.log"
+
+/*
+  Status dumps at Prestart, Go and End
+    Everything is read during the transition, after it has armed the
+    hardware: the block counters, TS busy and TD fiber masks and busy
+    counters, and a raw copy of the control and status registers at the
+    start of the A24 map of the TS and each TD (STATUS_REG_WORDS words,
+    below the scaler and FIFO areas).  A background thread only formats
+    the copy, so it never competes with the readout for the boards.
+    Go reads its snapshot before the pulser is started, and never the
+    register copies: those are from Prestart and End only.
+    'statuslevel' selects the detail:
+      0 : none
+      1 : compact - counters, busy and fiber masks
+      2 : (default) also the register copies, as offset/value
+*/
+#define STATUS_NONE     0
+#define STATUS_COMPACT  1
+#define STATUS_FULL     2
+#define STATUS_REG_WORDS  64
+
+/* Register maps of the TS and TDs, from tsLib and tdLib */
+extern volatile struct TS_A24RegStruct *TSp;
+extern volatile struct TD_A24RegStruct *TDp[];
+
+typedef struct
+{
+  char *transition;
+  int level;
+  int busyCounters;       /* also print the TD busy counters */
+  unsigned int blocks;
+  int bready;
+  unsigned int tsBusy;
+  int blockLevel;
+  WATCHDOG_TD td[21];
+  unsigned int tsRegs[STATUS_REG_WORDS];
+  unsigned int tdRegs[21][STATUS_REG_WORDS];
+} STATUS_SNAPSHOT;
+
+STATUS_SNAPSHOT statusSnap;
+int statusLevel = STATUS_FULL;
+pthread_t statusThread;
+int statusThreadActive = 0;
+
+/*
+  VME slot cache
+    The TS slot, the TD slots, and the firmware versions of the TS, TDs
+    and SD found at Download are saved in SLOT_CACHE_FILE.  The next
+    Download goes straight to the cached addresses and only does the full
+    scan if they don't match, with a warning naming the difference.
+    slotCacheClear() forces a full scan at the next Download.
+*/
+#define SLOT_CACHE_FILE  SBS_RUNINFO_DIR "/vmeslots.cache"
+
+typedef struct
+{
+  int pending;            /* Download in progress with this cache */
+  int tsSlot;
+  unsigned int tsFirmware;
+  unsigned int sdFirmware;
+  int nTD;
+  int tdSlot[21];
+  unsigned int tdFirmware[21];
+} SLOT_CACHE;
+
+SLOT_CACHE slotCache;
+int slotCacheValid = 0;
+
+/*
+  Warm Download
+    A full Download leaves a fingerprint of the hardware configuration in
+    WARM_DOWNLOAD_FILE:
+      - build of this list, trigger source, readout mode, block and
+        buffer level
+      - slots and firmware of the TS, TDs and SD, the SD active slots
+        and the TS holdoff rules only Download sets
+      - read back from the TS: event format, sync and clock source, and
+        from each TD: fiber enables, event format, trigger, sync and
+        clock source, and the connected fibers.  These are the registers
+        tsInit and tdInit program (WARM_REG_*, word index in the A24 map
+        common to the TS and TD) that nothing after Download changes.
+    The next Download maps the boards without initializing them and, if
+    the fingerprint read back is the same, skips the TS, TD and SD
+    initialization and the trigger table (Prestart loads it again).
+    Anything different, or a Download that did not finish, gives a full
+    Download.  The TD block buffer level is set either way.
+    fulldownload        : always do the full Download (from the next one)
+    downloadForceFull() : remex, full Download next time
+*/
+#define WARM_DOWNLOAD_FILE  SBS_RUNINFO_DIR "/warmdownload.cache"
+
+#define WARM_REG_FIBER    (0x04 >> 2)
+#define WARM_REG_FORMAT   (0x18 >> 2)
+#define WARM_REG_TRIGSRC  (0x20 >> 2)
+#define WARM_REG_SYNC     (0x24 >> 2)
+#define WARM_REG_CLOCK    (0x2C >> 2)
+#define WARM_REG_WORDS    (WARM_REG_CLOCK + 1)
+
+#ifndef TS_INIT_NO_INIT
+#define TS_INIT_NO_INIT  (1<<0)
+#endif
+#ifndef TD_INIT_NO_INIT
+#define TD_INIT_NO_INIT  (1<<0)
+#endif
+#ifndef SD_INIT_NO_INIT
+#define SD_INIT_NO_INIT  (1<<0)
+#endif
+
+int warmDownload = 0;         /* this Download is warm */
+int warmDisable = 0;          /* 'fulldownload' */
+int warmForce = 0;            /* downloadForceFull() */
+unsigned int warmSaved = 0;   /* fingerprint of the last full Download */
+
 /* prescale factors gathered here */
 #define NPSF 8
 int psfact[NPSF];
 
+/*
+  Accepted rate controller  (off unless 'ratectl' is set)
+    ratectl=<Hz>    : hold the accepted trigger rate under <Hz> by raising
+                      the prescale of the low priority inputs, and lowering
+                      it again (never below prescale.dat) when the rate
+                      drops under RATECTL_LOW of the target
+    lowprio=<mask>  : FP inputs (bit 0 = T1) the controller may prescale
+    runaway=<Hz>    : mask any enabled input whose raw rate goes over <Hz>,
+                      until it has been back under half of it for
+                      RATECTL_HOLD seconds
+    Raw input rates come from the TS front panel scalers, once every
+    RATECTL_PERIOD seconds.  The controller thread only decides: every
+    change is logged and queued, and rocTrigger sets the TS prescale or
+    FP input mask between blocks, then records it in the data stream as
+    a RATECTL_BANK bank in that block:
+      word 0 : seconds since Go
+           1 : action << 24 | input << 16 | old prescale << 8 | new prescale
+           2 : raw rate of the input (Hz)
+           3 : accepted rate (Hz)
+    The controller waits while the queue can't take a full step.  If no
+    block comes in for a tick (0.1 s), e.g. all the inputs are masked,
+    the controller thread applies the queue itself; those changes are
+    logged and in the run report, but not in the data stream.  The
+    prescales in force, block by block, are in the run report.
+*/
+#define RATECTL_PERIOD   1
+#define RATECTL_LOW      0.7
+#define RATECTL_HOLD     10
+#define RATECTL_MAXPS    15
+#define RATECTL_BANK     0x0B80
+#define RATECTL_RING     64
+#define RATECTL_BANK_MAXWORDS  (2 + 4*RATECTL_RING)
+#define TS_SCALER_FP     2      /* tsReadScalers: front panel inputs */
+
+#define RATECTL_PS_UP    1
+#define RATECTL_PS_DOWN  2
+#define RATECTL_MASK     3
+#define RATECTL_UNMASK   4
+
+int rateCtlTarget = 0;
+unsigned int rateCtlLowPrio = 0;
+int rateCtlRunaway = 0;
+
+unsigned int fpEnableMask = 0;        /* inputs enabled from prescale.dat */
+int rateCtlPS[NPSF];                  /* prescales set by the controller */
+unsigned int rateCtlMasked = 0;       /* inputs masked as runaway */
+int rateCtlQuiet[NPSF];               /* seconds a masked input has been quiet */
+
+/* Changes waiting to be applied and go into the data stream, written by
+   the controller thread, read by rocTrigger.  rateCtlRingFP is the FP
+   input mask after the change */
+unsigned int rateCtlRing[RATECTL_RING][4];
+unsigned int rateCtlRingFP[RATECTL_RING];
+unsigned int rateCtlHead = 0, rateCtlTail = 0;   /* __atomic */
+
+/* Held by whoever applies queued prescale and FP input changes:
+   rocTrigger, or a thread while no blocks come in */
+int prescaleApplyLock = 0;                       /* __atomic */
+
+/* Prescales and FP input mask applied by rocTrigger, for the run report.
+   input -1 is a change of the FP input mask to value */
+#define PRESCALE_HISTORY  256
+typedef struct
+{
+  int evntno;     /* in force from this block on */
+  int input;
+  int value;
+} PRESCALE_CHANGE;
+
+int prescaleInUse[NPSF];
+PRESCALE_CHANGE prescaleHistory[PRESCALE_HISTORY];
+int nPrescaleHistory = 0;
+
+pthread_t rateCtlThread;
+volatile int rateCtlRunning = 0;
+
+/* Prescale change from the control socket, applied by rocTrigger at the
+   next block boundary, or by the socket thread if no block comes in for
+   CONTROL_IDLE_US.  Input -1 = none pending */
+#define CONTROL_IDLE_US  100000
+volatile int controlPrescaleInput = -1;
+volatile int controlPrescaleValue = 0;
+
+/* Prescales set from the control socket, in place of prescale.dat until
+   the next Download (Prestart reads prescale.dat and applies these over
+   it), -1 = none.  The rate controller takes them as its new floor */
+int controlPS[NPSF];
+int rateCtlOverride[NPSF];            /* last ones the controller took */
+
 /*
   Read the user flags/configuration file.
   10sept21 - BM
@@ -148,13 +741,17 @@ readUserFlags()
 
   printf("%s: Reading user flags file.",
 	 __func__);
+  ttBegin("init_strings");
   init_strings();
+  ttEnd();
 
   char *fstring = getstr("ffile");
   if(fstring == NULL)
     {
       /* Load a default */
     }
+  else
+    free(fstring);
 
   /*
    *
@@ -165,6 +762,7 @@ readUserFlags()
    *       For example ps=0 means 1 and ps=3 means 8
    */
 
+  ttBegin("prescales");
   psfact[0] = getint(PS1);
   psfact[1] = getint(PS2);
   psfact[2] = getint(PS3);
@@ -189,12 +787,24 @@ readUserFlags()
   }
 
   printf("Enabled inputs mask = 0x%x \n",mask);
+  fpEnableMask = mask;
 
   /* Enable/Disable specific inputs */
   tsSetFPInput(mask);
 
   for (jj = 0; jj<NPSF; jj++) {
     if(psfact[jj]>0) tsSetTriggerPrescale(2,jj,psfact[jj]);
+    prescaleInUse[jj] = (psfact[jj]>0) ? psfact[jj] : 0;
+  }
+
+  /* Prescales set from the control socket since Download stay in place
+     of prescale.dat */
+  for (jj = 0; jj<NPSF; jj++) {
+    if((controlPS[jj] < 0) || (psfact[jj] < 0))
+      continue;
+    printf("T%d prescale %d from the control socket\n", jj+1, controlPS[jj]);
+    tsSetTriggerPrescale(2,jj,controlPS[jj]);
+    prescaleInUse[jj] = controlPS[jj];
   }
   // tsSetFPInput(0x10);
   // tsSetTriggerPrescale(2,4,0);
@@ -221,6 +831,197 @@ readUserFlags()
 
   // 30sept2021 8pm: Test turning off bufferlevel on TDs
   tdGSetBlockBufferLevel(0);
+  ttEnd();
+
+  ttBegin("options");
+
+  /* Adaptive block level */
+  flag = getflag("autoblocklevel");
+  if(flag)
+    {
+      autoBlockLevel = 1;
+
+      if(flag > 1)
+	autoBlockLevel = getint("autoblocklevel");
+    }
+  else
+    {
+      autoBlockLevel = 0;
+    }
+
+  maxBlockLevel = MAX_AUTO_BLOCKLEVEL;
+  if(getflag("maxblocklevel") > 1)
+    maxBlockLevel = getint("maxblocklevel");
+  if((maxBlockLevel < 1) || (maxBlockLevel > 255))
+    maxBlockLevel = MAX_AUTO_BLOCKLEVEL;
+
+  targetBlockRate = TARGET_BLOCK_RATE;
+  if(getflag("targetblockrate") > 1)
+    targetBlockRate = getint("targetblockrate");
+  if(targetBlockRate < 1)
+    targetBlockRate = TARGET_BLOCK_RATE;
+
+  /* Trigger holdoff window (rule 1), e.g. from holdoff calibration */
+  holdoffWindow = 0;
+  if(getflag("holdoff") > 1)
+    holdoffWindow = getint("holdoff");
+  if(holdoffWindow > 0)
+    {
+      printf("%s: Setting trigger holdoff rule 1 = %d\n",
+	     __func__, holdoffWindow);
+      tsSetTriggerHoldoff(1,holdoffWindow,1);
+    }
+
+  holdoffCalBusy = HOLDOFF_CAL_BUSY;
+  if(getflag("holdoffcalbusy") > 1)
+    {
+      fstring = getstr("holdoffcalbusy");
+      if(fstring)
+	{
+	  holdoffCalBusy = strtod(fstring, NULL);
+	  free(fstring);
+	}
+      if((holdoffCalBusy <= 0) || (holdoffCalBusy >= 1))
+	holdoffCalBusy = HOLDOFF_CAL_BUSY;
+    }
+
+  /* Remove dead ROCs from the slave configuration at Prestart */
+  dropDeadRocs = 0;
+  flag = getflag("dropdeadrocs");
+  if(flag)
+    {
+      dropDeadRocs = 1;
+
+      if(flag > 1)
+	dropDeadRocs = getint("dropdeadrocs");
+    }
+
+  /* Stuck readout watchdog, on unless 'watchdog=0' */
+  watchdogEnable = 1;
+  if(getflag("watchdog") > 1)
+    watchdogEnable = getint("watchdog");
+
+  /* Sync event consistency check, on unless 'synccheck=0' */
+  syncCheckEnable = 1;
+  if(getflag("synccheck") > 1)
+    syncCheckEnable = getint("synccheck");
+
+  /* Accepted rate controller */
+  rateCtlTarget = 0;
+  if(getflag("ratectl") > 1)
+    rateCtlTarget = getint("ratectl");
+
+  rateCtlLowPrio = 0;
+  if(getflag("lowprio") > 1)
+    rateCtlLowPrio = getint("lowprio");
+
+  rateCtlRunaway = 0;
+  if(getflag("runaway") > 1)
+    rateCtlRunaway = getint("runaway");
+
+  /* Busy transition trace sampling period (us), 0 disables */
+  busyTraceUs = 0;
+  if(getflag("busytrace") > 1)
+    busyTraceUs = getint("busytrace");
+
+  /* Trigger block capture size (MB), 0 disables */
+  captureMB = 0;
+  if(getflag("capture") > 1)
+    captureMB = getint("capture");
+
+#ifdef FAULT_INJECT
+  /* Fault injection */
+  faultFlagMask = 0;
+  if(getflag("faults") > 1)
+    faultFlagMask = getint("faults");
+
+  faultFlagRate = 1000;
+  if(getflag("faultrate") > 1)
+    faultFlagRate = getint("faultrate");
+#endif
+
+  /* Rate series */
+  rateSeriesMs = 0;
+  flag = getflag("rateseries");
+  if(flag)
+    {
+      rateSeriesMs = 100;
+
+      if(flag > 1)
+	rateSeriesMs = getint("rateseries");
+    }
+
+  rateSeriesHours = RATESERIES_HOURS;
+  if(getflag("rateserieshours") > 1)
+    rateSeriesHours = getint("rateserieshours");
+
+  /* Timestamp check */
+  tsCheckEnable = 0;
+  flag = getflag("tscheck");
+  if(flag)
+    {
+      tsCheckEnable = 1;
+
+      if(flag > 1)
+	tsCheckEnable = getint("tscheck");
+    }
+
+  /* FP input coincidences */
+  coincEnable = (getflag("coincidence") != 0);
+
+  /* Full Download every time */
+  warmDisable = (getflag("fulldownload") != 0);
+
+  /* Readout time budget */
+  blockBudgetUs = 0;
+  if(getflag("blockbudget") > 1)
+    blockBudgetUs = getint("blockbudget");
+
+  /* In-crate modules */
+  crateModuleList[0] = '\0';
+  if(getflag("modules") > 1)
+    {
+      char *modules = getstr("modules");
+      if(modules)
+	{
+	  snprintf(crateModuleList, sizeof(crateModuleList), "%s", modules);
+	  free(modules);
+	}
+    }
+
+  /* Trigger table rules */
+  trigRulesOK = 1;
+  if(getflag("trigrules") > 1)
+    {
+      char *rules = getstr("trigrules");
+      trigRulesOK = (triggerTableCompile(rules) == 0);
+      if(rules)
+	free(rules);
+    }
+  else
+    triggerTableCompile(NULL);
+
+  /* Detail of the status dumps */
+  statusLevel = STATUS_FULL;
+  if(getflag("statuslevel") > 1)
+    statusLevel = getint("statuslevel");
+
+  /* Folded stack output of the transition timing */
+  ttFolded = 0;
+  flag = getflag("ttfolded");
+  if(flag)
+    {
+      ttFolded = 1;
+
+      if(flag > 1)
+	ttFolded = getint("ttfolded");
+    }
+
+  printf("%s: autoblocklevel = %d  (max = %d, target block rate = %d Hz)\n",
+	 __func__, autoBlockLevel, maxBlockLevel, targetBlockRate);
+  ttEnd();
+
+  ttBegin("tdSlaveConfig");
 
   /* Order of operations..
      - check 'all'
@@ -243,85 +1044,2015 @@ readUserFlags()
       if(flag > 1)
 	flagval = getint("all");
 
-      for(i = 0; i < nSlaves; i++)
-	tdSlaveConfig[i].enable = flagval;
+      for(i = 0; i < nSlaves; i++)
+	tdSlaveConfig[i].enable = flagval;
+    }
+
+  /* enable 'BIGBITE', 'BIGBITE=1'
+     disable 'BIGBITE=0'
+     similar for 'LHRS' and 'HCAL'
+  */
+  int iarm=0;
+  for(iarm = 0; iarm < nArms; iarm++)
+    {
+      flagval = 0;
+      flag = getflag(armNames[iarm]);
+
+      if(flag)
+	{
+	  flagval = 1;
+
+	  if(flag > 1)
+	    flagval = getint(armNames[iarm]);
+
+	  for(i = 0; i < nSlaves; i++)
+	    {
+	      if(tdSlaveConfig[i].arm == iarm)
+		tdSlaveConfig[i].enable = flagval;
+	    }
+	}
+    }
+
+  /* enable 'bbshowerROC6', 'bbshowerROC6=1'
+     disable 'bbshowerROC6=0'
+     similar for the rest of the crates
+  */
+  int islave=0;
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      flagval = 0;
+      flag = getflag(tdSlaveConfig[islave].rocname);
+
+      if(flag)
+	{
+	  flagval = 1;
+
+	  if(flag > 1)
+	    flagval = getint(tdSlaveConfig[islave].rocname);
+
+	  tdSlaveConfig[islave].enable = flagval;
+	}
+
+    }
+
+  /* Print config */
+  printf("%s\n TD Slave Config from usrstringutils\n",
+	 __func__);
+  printf("  Enable      Slot      Port       Arm       Roc\n");
+  printf("|----------------------------------------------------------|\n");
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      printf("       %d  ",
+	     tdSlaveConfig[islave].enable);
+
+      printf("      %2d ",
+	     tdSlaveConfig[islave].slot);
+
+      printf("       %d  ",
+	     tdSlaveConfig[islave].port);
+
+      printf(" %-10s",
+	     armNames[tdSlaveConfig[islave].arm]);
+
+      printf(" %-20s",
+	     tdSlaveConfig[islave].rocname);
+
+      printf("\n");
+    }
+
+  printf("\n");
+  ttEnd();
+
+}
+
+/* Seconds between two timestamps */
+double
+timeDiff(struct timespec *t0, struct timespec *t1)
+{
+  return (double)(t1->tv_sec - t0->tv_sec) +
+    1e-9*(double)(t1->tv_nsec - t0->tv_nsec);
+}
+
+/*
+  File name for this run from the value of flag (a name with a single %d
+  for the run number, or none), or from dflt.  Any other '%' in the flag
+  value is refused, it is not a format string we can trust.
+*/
+void
+runFileName(char *path, size_t len, char *flag, char *dflt)
+{
+  char *pattern = getstr(flag), *pos;
+  int nconv = 0, ok = 1;
+
+  for(pos = pattern; pos && *pos; pos++)
+    {
+      if(*pos != '%')
+	continue;
+      if((pos[1] == 'd') && (nconv++ == 0))
+	pos++;
+      else
+	ok = 0;
+    }
+
+  if(pattern && !ok)
+    daLogMsg("ERROR","%s=%s: only a single %%d is allowed, using %s",
+	     flag, pattern, dflt);
+
+  snprintf(path, len, (pattern && ok) ? pattern : dflt, rol->runNumber);
+
+  if(pattern)
+    free(pattern);
+}
+
+/*
+  Block level that keeps the block rate near targetBlockRate for a trigger
+  rate of trigRate (Hz).  If a ROC spent more than half of the run busy,
+  go one step further to amortize its per-block overhead.
+*/
+int
+autoBlockLevelCalc(double trigRate, double maxBusy)
+{
+  int level;
+
+  level = (int)(trigRate / targetBlockRate) + 1;
+
+  if(maxBusy > 0.5)
+    level *= 2;
+
+  if(level < 1)
+    level = 1;
+  if(level > maxBlockLevel)
+    level = maxBlockLevel;
+
+  return level;
+}
+
+/*
+  Collect the run duration, trigger rate, and the busy fraction of each
+  enabled ROC from its TD port.  Timers must already be latched.
+*/
+void
+autoBlockLevelMeasure()
+{
+  double runtime;
+  int islave, busy;
+
+  clock_gettime(CLOCK_MONOTONIC, &runEndTime);
+  runtime = timeDiff(&runGoTime, &runEndTime);
+  if(runtime <= 0)
+    return;
+
+  /* Counted per block, so right whatever the block level did */
+  lastRunTrigRate = (double)runTriggers / runtime;
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      rocBusyFraction[islave] = 0;
+      if(!tdSlaveConfig[islave].enable)
+	continue;
+
+      busy = tdGetBusyCounter(tdSlaveConfig[islave].slot,
+			      tdSlaveConfig[islave].port);
+      if(busy > 0)
+	rocBusyFraction[islave] = busy * TD_BUSY_TICK_NS * 1e-9 / runtime;
+    }
+}
+
+/*
+  Prestart: pick the block level from the previous run's measurements.
+  Nothing changes if there was no previous run.
+*/
+void
+autoBlockLevelPrestart()
+{
+  double maxBusy = 0;
+  int islave, worst = -1;
+
+  autoBlockLevelBusy = 0;
+  if((autoBlockLevel == 0) || (lastRunTrigRate <= 0))
+    return;
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      if(rocBusyFraction[islave] > maxBusy)
+	{
+	  maxBusy = rocBusyFraction[islave];
+	  worst = islave;
+	}
+    }
+
+  blockLevel = autoBlockLevelCalc(lastRunTrigRate, maxBusy);
+  autoBlockLevelBusy = maxBusy;
+
+  daLogMsg("INFO","Auto block level = %d  (last run %.1f Hz, max ROC busy %.0f%% %s)",
+	   blockLevel, lastRunTrigRate, 100.*maxBusy,
+	   (worst >= 0) ? tdSlaveConfig[worst].rocname : "");
+}
+
+/*
+  Sync event: trigger rate over the last sync interval, for the peak rate
+  and the block level controller.
+*/
+void
+syncRateUpdate()
+{
+  struct timespec now;
+  double dt;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  dt = timeDiff(&lastSyncTime, &now);
+  if(dt <= 0)
+    return;
+
+  syncTrigRate = (runTriggers - lastSyncTriggers) / dt;
+  lastSyncTime = now;
+  lastSyncTriggers = runTriggers;
+
+  if(syncTrigRate > peakTrigRate)
+    peakTrigRate = syncTrigRate;
+}
+
+/* Keep the block level in force from block evntno on, if it changed */
+void
+blockLevelRecord(int evntno)
+{
+  int n = nBlockLevelHistory;
+
+  if((n > 0) && (blockLevelHistory[n - 1].level == blockLevel))
+    return;
+
+  if(n >= BLOCKLEVEL_HISTORY)
+    return;
+
+  blockLevelHistory[n].evntno = evntno;
+  blockLevelHistory[n].level = blockLevel;
+  __atomic_store_n(&nBlockLevelHistory, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+  Nothing in flight at sync block evntno: the TS had no block waiting and
+  every enabled ROC had read out all blocks up to this one, from the
+  counters latched at this sync event.
+*/
+int
+autoBlockLevelDrained(int evntno)
+{
+  SYNCCHECK_LATCH *l = &syncCheckLatch;
+  int islave;
+
+  if((l->evntno != evntno) || (l->tsBlocks != (unsigned int)evntno))
+    return 0;
+
+  for(islave = 0; islave < nSlaves; islave++)
+    if(tdSlaveConfig[islave].enable &&
+       (l->rocBlocks[islave] < (unsigned int)evntno))
+      return 0;
+
+  return 1;
+}
+
+/*
+  Sync event: request a new block level if the rate of the last sync
+  interval is off by more than a factor of two.  The request is only
+  written to the TS and TDs once they have drained; the TS applies it at
+  the following sync event, where rocTrigger picks it up with
+  tsGetCurrentBlockLevel.
+*/
+void
+autoBlockLevelSync(int evntno)
+{
+  BLOCKLEVEL_REQUEST *req;
+  int level, n;
+
+  if((autoBlockLevel < 2) || (syncTrigRate <= 0))
+    return;
+
+  level = autoBlockLevelCalc(syncTrigRate, autoBlockLevelBusy);
+
+  if((level >= 2*blockLevel) || (2*level <= blockLevel))
+    {
+      if(level != autoBlockLevelRequest)
+	autoBlockLevelWaited = 0;
+      autoBlockLevelRequest = level;
+    }
+  else
+    autoBlockLevelRequest = 0;
+
+  if(autoBlockLevelRequest == 0)
+    return;
+
+  if(!autoBlockLevelDrained(evntno))
+    {
+      autoBlockLevelWaited++;
+      return;
+    }
+
+  tsSetBlockLevel(autoBlockLevelRequest);
+  tdGSetBlockLevel(autoBlockLevelRequest);
+
+  n = nBlockLevelRequests;
+  if(n < BLOCKLEVEL_HISTORY)
+    {
+      req = &blockLevelRequests[n];
+      req->evntno = evntno;
+      req->level = autoBlockLevelRequest;
+      req->waited = autoBlockLevelWaited;
+      req->rate = syncTrigRate;
+      __atomic_store_n(&nBlockLevelRequests, n + 1, __ATOMIC_RELEASE);
+    }
+  autoBlockLevelRequest = 0;
+  autoBlockLevelWaited = 0;
+}
+
+/* Log the block level requests and changes since the last call, from the
+   sync event thread.  *nlevels and *nrequests are the entries done */
+void
+autoBlockLevelLog(int *nlevels, int *nrequests)
+{
+  BLOCKLEVEL_REQUEST *req;
+  int n;
+
+  n = __atomic_load_n(&nBlockLevelRequests, __ATOMIC_ACQUIRE);
+  for(; *nrequests < n; (*nrequests)++)
+    {
+      req = &blockLevelRequests[*nrequests];
+      daLogMsg("INFO","Requested block level %d at sync block %d (%.1f Hz%s)",
+	       req->level, req->evntno, req->rate,
+	       req->waited ? ", after waiting for the TDs to drain" : "");
+    }
+
+  n = __atomic_load_n(&nBlockLevelHistory, __ATOMIC_ACQUIRE);
+  for(; *nlevels < n; (*nlevels)++)
+    daLogMsg("INFO","Block level %d from block %d",
+	     blockLevelHistory[*nlevels].level, blockLevelHistory[*nlevels].evntno);
+}
+
+/*
+  Read the TD busy counter of every enabled ROC into busy[].
+  Timers are latched first.
+*/
+void
+sweepReadBusy(unsigned int *busy)
+{
+  int islot, islave;
+
+  for(islot = 0; islot < nTD; islot++)
+    tdLatchTimers(tdSlot(islot));
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      busy[islave] = 0;
+      if(tdSlaveConfig[islave].enable)
+	busy[islave] = tdGetBusyCounter(tdSlaveConfig[islave].slot,
+					tdSlaveConfig[islave].port);
+    }
+}
+
+/*
+  Livetime from the TS live and busy time counters, against a mark kept
+  by the caller.  tsLive(0) differences against one state inside tsLib,
+  shared by every thread that calls it.
+*/
+typedef struct
+{
+  unsigned int live;
+  unsigned int busy;
+} LIVE_MARK;
+
+void
+liveMark(LIVE_MARK *mark)
+{
+  mark->live = tsGetLiveTime();
+  mark->busy = tsGetBusyTime();
+}
+
+/* Percent live since mark, and move mark to now */
+double
+liveSince(LIVE_MARK *mark)
+{
+  unsigned int live = tsGetLiveTime(), busy = tsGetBusyTime();
+  double dlive = live - mark->live, dbusy = busy - mark->busy;
+
+  mark->live = live;
+  mark->busy = busy;
+
+  return (dlive + dbusy > 0) ? 100. * dlive / (dlive + dbusy) : 0;
+}
+
+/*
+  Let the pulser run for 'dwell' seconds (or until *running is cleared)
+  and fill step with the accepted blocks, livetime, and the busy fraction
+  of each ROC.
+*/
+void
+sweepStepMeasure(int dwell, volatile int *running, SWEEP_STEP *step)
+{
+  unsigned int busy0[nSlaves], busy1[nSlaves];
+  unsigned int blocks0;
+  struct timespec t0, t1;
+  LIVE_MARK live;
+  int islave, itick;
+
+  sweepReadBusy(busy0);
+  blocks0 = tsGetIntCount();
+  liveMark(&live);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(itick = 0; (itick < 10*dwell) && *running; itick++)
+    usleep(100000);
+
+  sweepReadBusy(busy1);
+  step->blocks = tsGetIntCount() - blocks0;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  step->seconds = timeDiff(&t0, &t1);
+  step->livetime = liveSince(&live);
+
+  step->maxBusy = 0;
+  step->worst = -1;
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      step->busy[islave] = 0;
+      if(step->seconds > 0)
+	step->busy[islave] = (busy1[islave] - busy0[islave]) *
+	  TD_BUSY_TICK_NS * 1e-9 / step->seconds;
+
+      if(step->busy[islave] > step->maxBusy)
+	{
+	  step->maxBusy = step->busy[islave];
+	  step->worst = islave;
+	}
+    }
+}
+
+void *
+holdoffCalSweep(void *arg)
+{
+  SWEEP_STEP step;
+  int iwin, irate, busyAny, best = -1, rule1;
+  char *fname;
+  FILE *fd;
+
+  /* Window and timestep bit of rule 1 before the sweep */
+  rule1 = tsGetTriggerHoldoff(1);
+
+  printf("%s: Holdoff calibration: %d windows x %d rates, %d s per step,"
+	 " busy above %g\n", __func__, NHOLDOFF_CAL_WINDOW, NHOLDOFF_CAL_RATE,
+	 HOLDOFF_CAL_DWELL, holdoffCalBusy);
+  printf("  Window  Rate  Blocks/s    MaxBusy  Roc\n");
+
+  for(iwin = 0; (iwin < NHOLDOFF_CAL_WINDOW) && sweepRunning; iwin++)
+    {
+      tsSetTriggerHoldoff(1,holdoffCalWindow[iwin],1);
+      busyAny = 0;
+
+      for(irate = 0; (irate < NHOLDOFF_CAL_RATE) && sweepRunning; irate++)
+	{
+	  tsSetRandomTrigger(1,holdoffCalRate[irate]);
+	  sweepStepMeasure(HOLDOFF_CAL_DWELL, &sweepRunning, &step);
+	  tsDisableRandomTrigger();
+
+	  printf("  %6d  %4d  %8.1f  %8.4f  %s\n",
+		 holdoffCalWindow[iwin], holdoffCalRate[irate],
+		 (step.seconds > 0) ? step.blocks / step.seconds : 0.,
+		 step.maxBusy,
+		 (step.worst >= 0) ? tdSlaveConfig[step.worst].rocname : "");
+
+	  if(step.maxBusy > holdoffCalBusy)
+	    busyAny = 1;
+	}
+
+      if(sweepRunning && !busyAny)
+	{
+	  best = holdoffCalWindow[iwin];
+	  break;
+	}
+    }
+
+  if(best < 0)
+    {
+      if(rule1 >= 0)
+	tsSetTriggerHoldoff(1, rule1 & 0x7F, (rule1 >> 7) & 1);
+      if(sweepRunning)
+	daLogMsg("ERROR","Holdoff calibration: no window free of front-end busy");
+      return NULL;
+    }
+
+  tsSetTriggerHoldoff(1,best,1);
+  daLogMsg("INFO","Holdoff calibration: smallest busy-free window = %d (applied)",
+	   best);
+
+  fname = getstr("holdoffcalfile");
+  fd = fopen(fname ? fname : HOLDOFF_CAL_FILE, "w");
+  if(fd)
+    {
+      fprintf(fd, "; trigger holdoff calibration\n");
+      fprintf(fd, "holdoff=%d\n", best);
+      fclose(fd);
+    }
+  else
+    {
+      printf("%s: ERROR opening %s\n", __func__,
+	     fname ? fname : HOLDOFF_CAL_FILE);
+    }
+  if(fname)
+    free(fname);
+
+  return NULL;
+}
+
+void *
+throughputSweepRun(void *arg)
+{
+  SWEEP_STEP *step;
+  int istep;
+
+  printf("%s: Throughput sweep: %d steps, %d s per step\n",
+	 __func__, NTHROUGHPUT_SWEEP, THROUGHPUT_SWEEP_DWELL);
+
+  nThroughputSweep = 0;
+  for(istep = 0; (istep < NTHROUGHPUT_SWEEP) && sweepRunning; istep++)
+    {
+      step = &throughputSweep[istep];
+
+      if(istep < NRANDOM_RATE)
+	{
+	  tsSetRandomTrigger(1,NRANDOM_RATE - 1 - istep);
+	  sweepStepMeasure(THROUGHPUT_SWEEP_DWELL, &sweepRunning, step);
+	  tsDisableRandomTrigger();
+	}
+      else
+	{
+	  tsSoftTrig(1,0xffff,throughputSweepPeriod[istep - NRANDOM_RATE],0);
+	  sweepStepMeasure(THROUGHPUT_SWEEP_DWELL, &sweepRunning, step);
+	  tsSoftTrig(1,0,100,0);
+	}
+
+      nThroughputSweep++;
+
+      printf("  step %2d: %8.1f blocks/s  live %5.1f%%  max busy %6.4f %s\n",
+	     istep, (step->seconds > 0) ? step->blocks / step->seconds : 0.,
+	     step->livetime, step->maxBusy,
+	     (step->worst >= 0) ? tdSlaveConfig[step->worst].rocname : "");
+    }
+
+  return NULL;
+}
+
+/* Write the throughput sweep as CSV, one row per step */
+void
+throughputSweepWrite()
+{
+  SWEEP_STEP *step;
+  char path[256];
+  int istep, islave;
+  FILE *fd;
+
+  if(nThroughputSweep == 0)
+    return;
+
+  runFileName(path, sizeof(path), "sweepfile", THROUGHPUT_SWEEP_FILE);
+
+  fd = fopen(path, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, path);
+      return;
+    }
+
+  fprintf(fd, "step,source,setting,seconds,blocks,trigger_rate_hz,livetime_pct");
+  for(islave = 0; islave < nSlaves; islave++)
+    if(tdSlaveConfig[islave].enable)
+      fprintf(fd, ",busy_%s", tdSlaveConfig[islave].rocname);
+  fprintf(fd, "\n");
+
+  for(istep = 0; istep < nThroughputSweep; istep++)
+    {
+      step = &throughputSweep[istep];
+
+      fprintf(fd, "%d,%s,%d,%.3f,%u,%.1f,%.1f",
+	      istep,
+	      (istep < NRANDOM_RATE) ? "random" : "fixed",
+	      (istep < NRANDOM_RATE) ? NRANDOM_RATE - 1 - istep :
+	      throughputSweepPeriod[istep - NRANDOM_RATE],
+	      step->seconds, step->blocks,
+	      (step->seconds > 0) ? step->blocks * blockLevel / step->seconds : 0.,
+	      step->livetime);
+
+      for(islave = 0; islave < nSlaves; islave++)
+	if(tdSlaveConfig[islave].enable)
+	  fprintf(fd, ",%.5f", step->busy[islave]);
+      fprintf(fd, "\n");
+    }
+
+  fclose(fd);
+  daLogMsg("INFO","Throughput sweep (%d steps) written to %s",
+	   nThroughputSweep, path);
+}
+
+void
+sweepStart(void *(*routine)(void *))
+{
+  sweepRunning = 1;
+  if(pthread_create(&sweepThread, NULL, routine, NULL) != 0)
+    {
+      printf("%s: ERROR creating sweep thread\n", __func__);
+      sweepRunning = 0;
+    }
+}
+
+void
+sweepStop()
+{
+  if(sweepRunning)
+    {
+      sweepRunning = 0;
+      pthread_join(sweepThread, NULL);
+    }
+}
+
+/*
+  Check the fiber link and trigger source enable of every enabled slave.
+  Each TD is read once for all of its ports.
+  Returns the number of problem ports.
+*/
+int
+fiberPreflight()
+{
+  unsigned int linkMask[21], trigSrcMask[21];
+  int ii, islave, slot, portmask, nbad = 0;
+
+  memset(linkMask, 0, sizeof(linkMask));
+  memset(trigSrcMask, 0, sizeof(trigSrcMask));
+
+  for(ii = 0; ii < nTD; ii++)
+    {
+      slot = tdID[ii];
+      linkMask[slot] = tdGetConnectedFiberMask(slot);
+      trigSrcMask[slot] = FAULT_TRIGSRC(tdGetTrigSrcEnabledFiberMask(slot));
+    }
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      if(!tdSlaveConfig[islave].enable)
+	continue;
+
+      slot = tdSlaveConfig[islave].slot;
+      portmask = 1 << (tdSlaveConfig[islave].port - 1);
+
+      if(linkMask[slot] & trigSrcMask[slot] & portmask)
+	continue;
+
+      nbad++;
+      daLogMsg("WARN","%s (TD slot %d port %d): %s%s",
+	       tdSlaveConfig[islave].rocname, slot,
+	       tdSlaveConfig[islave].port,
+	       (linkMask[slot] & portmask) ? "" : "fiber link down ",
+	       (trigSrcMask[slot] & portmask) ? "" : "trigger source not enabled");
+
+      if(dropDeadRocs)
+	{
+	  tdSlaveConfig[islave].enable = 0;
+	  daLogMsg("WARN","%s removed from the run (dropdeadrocs)",
+		   tdSlaveConfig[islave].rocname);
+	}
+    }
+
+  printf("%s: %d problem port(s)\n", __func__, nbad);
+
+  return nbad;
+}
+
+/* Read the fiber masks and latched busy counters of every TD */
+void
+watchdogReadTD(WATCHDOG_TD *td)
+{
+  int ii, iport;
+
+  for(ii = 0; ii < nTD; ii++)
+    {
+      td[ii].slot = tdID[ii];
+      tdLatchTimers(tdID[ii]);
+      td[ii].linkMask = tdGetConnectedFiberMask(tdID[ii]);
+      td[ii].trigSrcMask = tdGetTrigSrcEnabledFiberMask(tdID[ii]);
+      for(iport = 0; iport < TD_NPORTS; iport++)
+	td[ii].busy[iport] = tdGetBusyCounter(tdID[ii], iport + 1);
+    }
+}
+
+/*
+  Pick the ROC holding up the readout: first any enabled slave that has
+  dropped its link or trigger source, otherwise the one whose busy counter
+  grew the most since 'before'.
+*/
+int
+watchdogCulprit(WATCHDOG_TD *before, WATCHDOG_TD *after)
+{
+  int ii, islave, iport, portmask, worst = -1;
+  unsigned int growth, maxGrowth = 0;
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      if(!tdSlaveConfig[islave].enable)
+	continue;
+
+      iport = tdSlaveConfig[islave].port - 1;
+      portmask = 1 << iport;
+
+      for(ii = 0; ii < nTD; ii++)
+	{
+	  if(after[ii].slot != tdSlaveConfig[islave].slot)
+	    continue;
+
+	  if(!(after[ii].linkMask & after[ii].trigSrcMask & portmask))
+	    return islave;
+
+	  growth = after[ii].busy[iport] - before[ii].busy[iport];
+	  if(growth > maxGrowth)
+	    {
+	      maxGrowth = growth;
+	      worst = islave;
+	    }
+	}
+    }
+
+  return worst;
+}
+
+void *
+watchdogRun(void *arg)
+{
+  WATCHDOG_TD tdBefore[21];
+  WATCHDOG_SNAPSHOT *snap;
+  unsigned int blocks, lastBlocks;
+  int stalled = 0, reported = 0, itick;
+
+  lastBlocks = tsGetIntCount();
+  watchdogReadTD(tdBefore);
+
+  while(watchdogRunning)
+    {
+      for(itick = 0; (itick < 10*WATCHDOG_PERIOD) && watchdogRunning; itick++)
+	usleep(100000);
+
+      blocks = tsGetIntCount();
+      if(blocks != lastBlocks)
+	{
+	  lastBlocks = blocks;
+	  stalled = 0;
+	  reported = 0;
+	  watchdogReadTD(tdBefore);
+	  continue;
+	}
+
+      stalled += WATCHDOG_PERIOD;
+      if((stalled < WATCHDOG_STALL) || reported)
+	continue;
+
+      snap = &watchdogRing[watchdogCount % WATCHDOG_RING];
+      memset(snap, 0, sizeof(WATCHDOG_SNAPSHOT));
+      snap->tsBusy = tsGetBusyStatus(0);
+      if(snap->tsBusy == 0)
+	continue;  /* No triggers, but nothing is holding busy */
+
+      snap->time = time(NULL);
+      snap->blocks = blocks;
+      snap->bready = tsBReady();
+      watchdogReadTD(snap->td);
+      snap->culprit = watchdogCulprit(tdBefore, snap->td);
+      watchdogCount++;
+      reported = 1;
+
+      daLogMsg("ERROR","Readout stalled for %d s at block %d, TS busy 0x%x: %s",
+	       stalled, blocks, snap->tsBusy,
+	       (snap->culprit >= 0) ? tdSlaveConfig[snap->culprit].rocname :
+	       "no ROC identified");
+    }
+
+  return NULL;
+}
+
+/* Remex function to print the watchdog snapshots, most recent last */
+void
+watchdogPrint()
+{
+  WATCHDOG_SNAPSHOT *snap;
+  int isnap, ii, iport, first;
+
+  first = (watchdogCount > WATCHDOG_RING) ? watchdogCount - WATCHDOG_RING : 0;
+
+  for(isnap = first; isnap < watchdogCount; isnap++)
+    {
+      snap = &watchdogRing[isnap % WATCHDOG_RING];
+
+      printf("Stall %d: %s", isnap, ctime(&snap->time));
+      printf("  blocks = %d  bready = %d  TS busy = 0x%08x  culprit = %s\n",
+	     snap->blocks, snap->bready, snap->tsBusy,
+	     (snap->culprit >= 0) ? tdSlaveConfig[snap->culprit].rocname : "?");
+
+      for(ii = 0; ii < nTD; ii++)
+	{
+	  printf("  TD %2d  link 0x%02x  trigsrc 0x%02x  busy",
+		 snap->td[ii].slot, snap->td[ii].linkMask,
+		 snap->td[ii].trigSrcMask);
+	  for(iport = 0; iport < TD_NPORTS; iport++)
+	    printf(" %08x", snap->td[ii].busy[iport]);
+	  printf("\n");
+	}
+    }
+}
+
+void
+watchdogStart()
+{
+  if(!watchdogEnable)
+    return;
+
+  watchdogRunning = 1;
+  if(pthread_create(&watchdogThread, NULL, watchdogRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating watchdog thread\n", __func__);
+      watchdogRunning = 0;
+    }
+}
+
+void
+watchdogStop()
+{
+  if(watchdogRunning)
+    {
+      watchdogRunning = 0;
+      pthread_join(watchdogThread, NULL);
+    }
+}
+
+/* Latch the counters of sync event evntno (rocTriggerSync) */
+void
+syncCheckLatchCounters(int evntno)
+{
+  SYNCCHECK_LATCH *l = &syncCheckLatch;
+  int islave;
+
+  __atomic_store_n(&syncCheckSeq, syncCheckSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  l->evntno = evntno;
+  l->triggers = runTriggers;
+  l->tsTriggers = tsGetEventCounter();
+  l->tsBlocks = evntno + tsBReady();
+  for(islave = 0; islave < nSlaves; islave++)
+    if(tdSlaveConfig[islave].enable)
+      l->rocBlocks[islave] = tdGetBlockCounter(tdSlaveConfig[islave].slot,
+					       tdSlaveConfig[islave].port);
+
+  __atomic_store_n(&syncCheckSeq, syncCheckSeq + 1, __ATOMIC_RELEASE);
+}
+
+/* Check one latched sync event, see 'Sync event consistency check' */
+void
+syncCheckEvent(SYNCCHECK_LATCH *l, int lastEvntno)
+{
+  int islave, drift, evntno = l->evntno;
+
+  if((lastEvntno > 0) && (evntno - lastEvntno != SYNC_INTERVAL))
+    {
+      syncCheckErrors++;
+      daLogMsg("ERROR","Sync events at blocks %d and %d, %d blocks apart (expected %d)",
+	       lastEvntno, evntno, evntno - lastEvntno, SYNC_INTERVAL);
+    }
+
+  if(l->tsTriggers < l->triggers)
+    {
+      syncCheckErrors++;
+      daLogMsg("ERROR","TS trigger count %llu is behind the %llu triggers read out (block %d)",
+	       l->tsTriggers, l->triggers, evntno);
+    }
+
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      if(!tdSlaveConfig[islave].enable)
+	continue;
+
+      drift = (int)(l->tsBlocks - l->rocBlocks[islave]);
+
+      if((drift >= 0) && (drift <= bufferLevel + SYNCCHECK_SLACK))
+	{
+	  if(syncCheckBad[islave] >= 2)
+	    daLogMsg("INFO","%s back in step with the TS at block %d",
+		     tdSlaveConfig[islave].rocname, evntno);
+	  syncCheckBad[islave] = 0;
+	  continue;
+	}
+
+      if(++syncCheckBad[islave] != 2)
+	continue;
+
+      syncCheckErrors++;
+      daLogMsg("ERROR","%s (TD slot %d port %d) out of step: %u blocks "
+	       "acknowledged, TS at %u (block %d)",
+	       tdSlaveConfig[islave].rocname, tdSlaveConfig[islave].slot,
+	       tdSlaveConfig[islave].port, l->rocBlocks[islave], l->tsBlocks,
+	       evntno);
+    }
+}
+
+void *
+syncCheckRun(void *arg)
+{
+  SYNCCHECK_LATCH latch;
+  unsigned int seq, lastSeq = 0;
+  int lastEvntno = 0, nlevels = 1, nrequests = 0;
+
+  while(syncCheckRunning)
+    {
+      usleep(SYNCCHECK_POLL_US);
+
+      autoBlockLevelLog(&nlevels, &nrequests);
+      if(!syncCheckEnable)
+	continue;
+
+      seq = __atomic_load_n(&syncCheckSeq, __ATOMIC_ACQUIRE);
+      if((seq == lastSeq) || (seq & 1))
+	continue;
+
+      /* Copy the latch, and retry at the next poll if it was rewritten */
+      memcpy(&latch, &syncCheckLatch, sizeof(latch));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&syncCheckSeq, __ATOMIC_RELAXED) != seq)
+	continue;
+
+      /* Only check the spacing of consecutive sync events */
+      syncCheckEvent(&latch, (seq == lastSeq + 2) ? lastEvntno : 0);
+
+      lastSeq = seq;
+      lastEvntno = latch.evntno;
+    }
+
+  autoBlockLevelLog(&nlevels, &nrequests);
+
+  return NULL;
+}
+
+void
+syncCheckStart()
+{
+  syncCheckSeq = 0;
+  syncCheckErrors = 0;
+  memset(syncCheckBad, 0, sizeof(syncCheckBad));
+
+  /* Also latches the counters and logs for the block level controller */
+  if(!syncCheckEnable && (autoBlockLevel < 2))
+    return;
+
+  syncCheckRunning = 1;
+  if(pthread_create(&syncCheckThread, NULL, syncCheckRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating sync check thread\n", __func__);
+      syncCheckRunning = 0;
+    }
+}
+
+void
+syncCheckStop()
+{
+  if(syncCheckRunning)
+    {
+      syncCheckRunning = 0;
+      pthread_join(syncCheckThread, NULL);
+      if(syncCheckEnable)
+	printf("%s: %u consistency error(s) at sync events\n",
+	       __func__, syncCheckErrors);
+    }
+}
+
+/* Log a controller change and queue it for the data stream */
+void
+rateCtlRecord(int action, int input, int oldps, int newps,
+	      double raw, double accepted)
+{
+  static char *actions[] = { "", "prescale up", "prescale down",
+			     "masked (runaway)", "unmasked" };
+  struct timespec now;
+  unsigned int head = rateCtlHead;
+
+  daLogMsg((action == RATECTL_MASK) ? "WARN" : "INFO",
+	   "Rate control: T%d %s, prescale %d -> %d (raw %.0f Hz, accepted %.0f Hz)",
+	   input + 1, actions[action], oldps, newps, raw, accepted);
+
+  /* rateCtlStep made sure there is room */
+  if(head - __atomic_load_n(&rateCtlTail, __ATOMIC_ACQUIRE) >= RATECTL_RING)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rateCtlRing[head % RATECTL_RING][0] = now.tv_sec - runGoTime.tv_sec;
+  rateCtlRing[head % RATECTL_RING][1] = (action << 24) | (input << 16) |
+    ((oldps & 0xFF) << 8) | (newps & 0xFF);
+  rateCtlRing[head % RATECTL_RING][2] = raw;
+  rateCtlRing[head % RATECTL_RING][3] = accepted;
+  rateCtlRingFP[head % RATECTL_RING] = fpEnableMask & ~rateCtlMasked;
+
+  __atomic_store_n(&rateCtlHead, head + 1, __ATOMIC_RELEASE);
+  tsTriggerWake();
+}
+
+/* Lowest prescale the rate controller may set: prescale.dat, or the
+   control socket override */
+int
+prescaleFloor(int input)
+{
+  int ps = __atomic_load_n(&controlPS[input], __ATOMIC_RELAXED);
+
+  if(ps < 0)
+    ps = psfact[input];
+
+  return (ps > 0) ? ps : 0;
+}
+
+/* Keep a prescale (input >= 0) or FP input mask (input -1) applied
+   from block evntno on */
+void
+prescaleRecord(int evntno, int input, int value)
+{
+  if(input >= 0)
+    prescaleInUse[input] = value;
+
+  if(nPrescaleHistory >= PRESCALE_HISTORY)
+    return;
+
+  prescaleHistory[nPrescaleHistory].evntno = evntno;
+  prescaleHistory[nPrescaleHistory].input = input;
+  prescaleHistory[nPrescaleHistory].value = value;
+  nPrescaleHistory++;
+}
+
+/* Take prescaleApplyLock, 0 if someone else has it */
+static inline int
+prescaleApplyTake()
+{
+  return !__atomic_exchange_n(&prescaleApplyLock, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+prescaleApplyGive()
+{
+  __atomic_store_n(&prescaleApplyLock, 0, __ATOMIC_RELEASE);
+}
+
+/* Apply queued change tail, in force after block evntno */
+void
+rateCtlApply(int evntno, unsigned int tail)
+{
+  unsigned int *rec = rateCtlRing[tail % RATECTL_RING];
+  int action = rec[1] >> 24, input = (rec[1] >> 16) & 0xFF;
+
+  if((action == RATECTL_MASK) || (action == RATECTL_UNMASK))
+    {
+      tsSetFPInput(rateCtlRingFP[tail % RATECTL_RING]);
+      prescaleRecord(evntno + 1, -1, rateCtlRingFP[tail % RATECTL_RING]);
+    }
+  else
+    {
+      tsSetTriggerPrescale(2, input, rec[1] & 0xFF);
+      prescaleRecord(evntno + 1, input, rec[1] & 0xFF);
+    }
+}
+
+/* Apply the queued changes and put them into the event, from rocTrigger
+   between blocks */
+void
+rateCtlBank(int evntno)
+{
+  unsigned int head, tail;
+
+  /* The controller thread is applying them */
+  if(!prescaleApplyTake())
+    return;
+
+  head = __atomic_load_n(&rateCtlHead, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&rateCtlTail, __ATOMIC_RELAXED);
+
+  BANKOPEN(RATECTL_BANK, BT_UI4, blockLevel);
+  for(; tail != head; tail++)
+    {
+      rateCtlApply(evntno, tail);
+
+      memcpy((void *)dma_dabufp, rateCtlRing[tail % RATECTL_RING],
+	     4*sizeof(unsigned int));
+      dma_dabufp += 4;
+    }
+  BANKCLOSE;
+
+  __atomic_store_n(&rateCtlTail, tail, __ATOMIC_RELEASE);
+  prescaleApplyGive();
+}
+
+/* Apply the queued changes from the controller thread, when no block has
+   come in to do it.  They stay out of the data stream */
+void
+rateCtlApplyIdle()
+{
+  unsigned int head, tail;
+  int evntno;
+
+  if(!prescaleApplyTake())
+    return;
+
+  head = __atomic_load_n(&rateCtlHead, __ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&rateCtlTail, __ATOMIC_RELAXED);
+  if(tail != head)
+    {
+      evntno = tsGetIntCount();
+      daLogMsg("INFO","Rate control: no blocks, %d change(s) applied after block %d",
+	       head - tail, evntno);
+      for(; tail != head; tail++)
+	rateCtlApply(evntno, tail);
+
+      __atomic_store_n(&rateCtlTail, tail, __ATOMIC_RELEASE);
+    }
+
+  prescaleApplyGive();
+}
+
+void
+rateCtlStep(double *raw, double accepted)
+{
+  int jj, pick = -1, oldps, ps;
+  double best = 0, contrib;
+
+  /* Prescales set from the control socket since the last step */
+  for(jj = 0; jj < NPSF; jj++)
+    {
+      ps = __atomic_load_n(&controlPS[jj], __ATOMIC_RELAXED);
+      if(ps != rateCtlOverride[jj])
+	rateCtlPS[jj] = prescaleFloor(jj);
+      rateCtlOverride[jj] = ps;
+    }
+
+  /* Wait for rocTrigger to apply the queued changes, a step may queue
+     one for each input and a prescale change */
+  if(__atomic_load_n(&rateCtlHead, __ATOMIC_RELAXED) -
+     __atomic_load_n(&rateCtlTail, __ATOMIC_ACQUIRE) > RATECTL_RING - (NPSF + 1))
+    return;
+
+  /* Runaway inputs */
+  for(jj = 0; (jj < NPSF) && (rateCtlRunaway > 0); jj++)
+    {
+      if(!(fpEnableMask & (1 << jj)))
+	continue;
+
+      if(!(rateCtlMasked & (1 << jj)))
+	{
+	  if(raw[jj] > rateCtlRunaway)
+	    {
+	      rateCtlMasked |= (1 << jj);
+	      rateCtlQuiet[jj] = 0;
+	      rateCtlRecord(RATECTL_MASK, jj, rateCtlPS[jj], rateCtlPS[jj],
+			    raw[jj], accepted);
+	    }
+	  continue;
+	}
+
+      rateCtlQuiet[jj] = (raw[jj] < 0.5 * rateCtlRunaway) ?
+	rateCtlQuiet[jj] + RATECTL_PERIOD : 0;
+      if(rateCtlQuiet[jj] >= RATECTL_HOLD)
+	{
+	  rateCtlMasked &= ~(1 << jj);
+	  rateCtlRecord(RATECTL_UNMASK, jj, rateCtlPS[jj], rateCtlPS[jj],
+			raw[jj], accepted);
+	}
+    }
+
+  if(rateCtlTarget <= 0)
+    return;
+
+  if(accepted > rateCtlTarget)
+    {
+      /* Prescale the low priority input accepting the most */
+      for(jj = 0; jj < NPSF; jj++)
+	{
+	  if(!(rateCtlLowPrio & fpEnableMask & ~rateCtlMasked & (1 << jj)) ||
+	     (rateCtlPS[jj] >= RATECTL_MAXPS))
+	    continue;
+
+	  contrib = raw[jj] / (1 << rateCtlPS[jj]);
+	  if(contrib > best)
+	    {
+	      best = contrib;
+	      pick = jj;
+	    }
+	}
+
+      if(pick < 0)
+	return;
+
+      oldps = rateCtlPS[pick]++;
+      rateCtlRecord(RATECTL_PS_UP, pick, oldps, rateCtlPS[pick],
+		    raw[pick], accepted);
+    }
+  else if(accepted < RATECTL_LOW * rateCtlTarget)
+    {
+      /* Give back the largest extra prescale */
+      for(jj = 0; jj < NPSF; jj++)
+	{
+	  if(!(fpEnableMask & (1 << jj)))
+	    continue;
+
+	  if(rateCtlPS[jj] - prescaleFloor(jj) > best)
+	    {
+	      best = rateCtlPS[jj] - prescaleFloor(jj);
+	      pick = jj;
+	    }
+	}
+
+      if(pick < 0)
+	return;
+
+      oldps = rateCtlPS[pick]--;
+      rateCtlRecord(RATECTL_PS_DOWN, pick, oldps, rateCtlPS[pick],
+		    raw[pick], accepted);
+    }
+}
+
+void *
+rateCtlRun(void *arg)
+{
+  unsigned int scaler[32], last[32];
+  unsigned long long lastTriggers, tickTriggers, triggers;
+  struct timespec t0, t1;
+  double raw[NPSF], dt, accepted;
+  int jj, itick;
+
+  tsReadScalers(last, TS_SCALER_FP);
+  lastTriggers = tickTriggers = runTriggers;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  while(rateCtlRunning)
+    {
+      for(itick = 0; (itick < 10*RATECTL_PERIOD) && rateCtlRunning; itick++)
+	{
+	  usleep(100000);
+
+	  /* No block this tick to apply the queue, e.g. every input masked.
+	     If blocks came but left it (the control socket had the lock),
+	     wake rocTrigger again */
+	  triggers = runTriggers;
+	  if(__atomic_load_n(&rateCtlHead, __ATOMIC_RELAXED) !=
+	     __atomic_load_n(&rateCtlTail, __ATOMIC_ACQUIRE))
+	    {
+	      if(triggers == tickTriggers)
+		rateCtlApplyIdle();
+	      else
+		tsTriggerWake();
+	    }
+	  tickTriggers = triggers;
+	}
+
+      tsReadScalers(scaler, TS_SCALER_FP);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      dt = timeDiff(&t0, &t1);
+      if(dt <= 0)
+	continue;
+
+      for(jj = 0; jj < NPSF; jj++)
+	raw[jj] = (scaler[jj] - last[jj]) / dt;
+      accepted = (runTriggers - lastTriggers) / dt;
+
+      rateCtlStep(raw, accepted);
+
+      memcpy(last, scaler, sizeof(last));
+      lastTriggers = runTriggers;
+      t0 = t1;
+    }
+
+  return NULL;
+}
+
+void
+rateCtlStart()
+{
+  int jj;
+
+  for(jj = 0; jj < NPSF; jj++)
+    {
+      rateCtlPS[jj] = prescaleFloor(jj);
+      rateCtlOverride[jj] = controlPS[jj];
+      rateCtlQuiet[jj] = 0;
+    }
+  rateCtlMasked = 0;
+  rateCtlHead = rateCtlTail = 0;
+
+  memcpy(prescaleInUse, rateCtlPS, sizeof(prescaleInUse));
+  nPrescaleHistory = 0;
+
+  if((rateCtlTarget <= 0) && (rateCtlRunaway <= 0))
+    return;
+
+  daLogMsg("INFO","Rate control: target %d Hz, low priority 0x%x, runaway %d Hz",
+	   rateCtlTarget, rateCtlLowPrio, rateCtlRunaway);
+
+  rateCtlRunning = 1;
+  if(pthread_create(&rateCtlThread, NULL, rateCtlRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating rate control thread\n", __func__);
+      rateCtlRunning = 0;
+    }
+}
+
+void
+rateCtlStop()
+{
+  if(rateCtlRunning)
+    {
+      rateCtlRunning = 0;
+      pthread_join(rateCtlThread, NULL);
+    }
+}
+
+/* Remex function to write the busy trace of this run */
+int
+busyTraceSave()
+{
+  char path[256];
+
+  snprintf(path, sizeof(path), BUSYTRACE_FILE, rol->runNumber);
+
+  return busyTraceDump(path);
+}
+
+void
+triggerCapturePrestart()
+{
+  char *fname, path[256];
+
+  triggerCaptureClose();
+  triggerReplayClose();
+
+  fname = getstr("replay");
+  if(fname)
+    {
+      if(triggerReplayOpen(fname) == 0)
+	{
+	  blockLevel = replayHeader->blockLevel;
+	  daLogMsg("WARN","Trigger blocks replayed from %s", fname);
+	}
+      free(fname);
+    }
+
+  if(captureMB > 0)
+    {
+      runFileName(path, sizeof(path), "capturefile", TRIGGER_CAPTURE_FILE);
+      triggerCaptureOpen(path, captureMB);
+    }
+}
+
+/* Live and busy time at the last rate series sample */
+LIVE_MARK rateSeriesLive;
+
+/* rateSeries hook, runs on the sampler thread */
+void
+rateSeriesFill(RATESERIES_SAMPLE *sample, double seconds)
+{
+  unsigned int busy[nSlaves];
+  int islave;
+
+  sample->blocks = tsGetIntCount();
+  sample->triggers = runTriggers;
+  memcpy(sample->inputs, rateSeriesInputs, sizeof(sample->inputs));
+  sample->livetime = liveSince(&rateSeriesLive);
+  sample->bready = tsBReady();
+
+  sweepReadBusy(busy);
+  for(islave = 0; (islave < nSlaves) && (islave < RATESERIES_MAXROCS); islave++)
+    {
+      if(tdSlaveConfig[islave].enable && (seconds > 0))
+	sample->busy[islave] = (busy[islave] - rateSeriesBusy[islave]) *
+	  TD_BUSY_TICK_NS * 1e-9 / seconds;
+      rateSeriesBusy[islave] = busy[islave];
+    }
+}
+
+void
+rateSeriesPrestart()
+{
+  char path[256];
+  int islave;
+
+  rateSeriesStop();
+
+  if(rateSeriesMs <= 0)
+    return;
+
+  snprintf(path, sizeof(path), RATESERIES_FILE, rol->runNumber);
+  if(rateSeriesOpen(path, rateSeriesMs,
+		    (int)(3600000.0 * rateSeriesHours / rateSeriesMs)) != 0)
+    return;
+
+  rateSeriesHeader->nrocs = (nSlaves < RATESERIES_MAXROCS) ? nSlaves : RATESERIES_MAXROCS;
+  for(islave = 0; islave < (int)rateSeriesHeader->nrocs; islave++)
+    strncpy(rateSeriesHeader->rocname[islave], tdSlaveConfig[islave].rocname,
+	    sizeof(rateSeriesHeader->rocname[islave]) - 1);
+}
+
+void
+runReportReset()
+{
+  memset(readoutLatency, 0, sizeof(readoutLatency));
+  runTriggers = 0;
+  peakTrigRate = 0;
+}
+
+/* rocTrigger latency (us) below which a fraction p of the blocks fall */
+double
+latencyPercentile(double p)
+{
+  unsigned long long total = 0, sum = 0;
+  int ibin;
+
+  for(ibin = 0; ibin <= LATENCY_NBINS; ibin++)
+    total += readoutLatency[ibin];
+  if(total == 0)
+    return 0;
+
+  for(ibin = 0; ibin <= LATENCY_NBINS; ibin++)
+    {
+      sum += readoutLatency[ibin];
+      if(sum >= p * total)
+	break;
+    }
+
+  return 1e-3 * (ibin + 1) * LATENCY_BIN_NS;
+}
+
+void
+runReportWrite()
+{
+  char path[256];
+  double runtime;
+  int islave, jj, first;
+  FILE *fd;
+
+  snprintf(path, sizeof(path), RUNREPORT_FILE, rol->runNumber);
+  fd = fopen(path, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, path);
+      return;
+    }
+
+  runtime = timeDiff(&runGoTime, &runEndTime);
+
+  fprintf(fd, "{\n");
+  fprintf(fd, "  \"run\": %d,\n", rol->runNumber);
+  fprintf(fd, "  \"trigger_source\": %d,\n", rocTriggerSource);
+  fprintf(fd, "  \"duration_s\": %.3f,\n", runtime);
+  fprintf(fd, "  \"blocks\": %d,\n", tsGetIntCount());
+  fprintf(fd, "  \"triggers\": %llu,\n", runTriggers);
+  fprintf(fd, "  \"average_rate_hz\": %.1f,\n",
+	  (runtime > 0) ? runTriggers / runtime : 0.);
+  fprintf(fd, "  \"peak_rate_hz\": %.1f,\n", peakTrigRate);
+  fprintf(fd, "  \"livetime_pct\": %.1f,\n", 0.1 * tsLive(1));
+  fprintf(fd, "  \"sync_check_errors\": %u,\n", syncCheckErrors);
+
+  fprintf(fd, "  \"block_level\": %d,\n", blockLevel);
+  fprintf(fd, "  \"block_levels\": [");
+  for(jj = 0; jj < nBlockLevelHistory; jj++)
+    fprintf(fd, "%s{ \"from_block\": %d, \"level\": %d }", jj ? ", " : "",
+	    blockLevelHistory[jj].evntno, blockLevelHistory[jj].level);
+  fprintf(fd, "],\n");
+  fprintf(fd, "  \"buffer_level\": %d,\n", bufferLevel);
+  fprintf(fd, "  \"sync_interval\": %d,\n", SYNC_INTERVAL);
+  fprintf(fd, "  \"prescales\": [");
+  for(jj = 0; jj < NPSF; jj++)
+    fprintf(fd, "%s%d", jj ? ", " : "", psfact[jj]);
+  fprintf(fd, "],\n");
+  fprintf(fd, "  \"prescale_changes\": [");
+  for(jj = 0; jj < nPrescaleHistory; jj++)
+    {
+      if(prescaleHistory[jj].input < 0)
+	fprintf(fd, "%s{ \"from_block\": %d, \"fp_enable\": %d }", jj ? ", " : "",
+		prescaleHistory[jj].evntno, prescaleHistory[jj].value);
+      else
+	fprintf(fd, "%s{ \"from_block\": %d, \"input\": %d, \"prescale\": %d }",
+		jj ? ", " : "", prescaleHistory[jj].evntno,
+		prescaleHistory[jj].input + 1, prescaleHistory[jj].value);
+    }
+  fprintf(fd, "],\n");
+  fprintf(fd, "  \"prescales_at_end\": [");
+  for(jj = 0; jj < NPSF; jj++)
+    fprintf(fd, "%s%d", jj ? ", " : "",
+	    (fpEnableMask & (1 << jj)) ? prescaleInUse[jj] : -1);
+  fprintf(fd, "],\n");
+
+  fprintf(fd, "  \"readout_latency_us\": { \"p50\": %.1f, \"p90\": %.1f, "
+	  "\"p99\": %.1f, \"p999\": %.1f },\n",
+	  latencyPercentile(0.5), latencyPercentile(0.9),
+	  latencyPercentile(0.99), latencyPercentile(0.999));
+
+  fprintf(fd, "  \"rocs\": {");
+  first = 1;
+  for(islave = 0; islave < nSlaves; islave++)
+    {
+      if(!tdSlaveConfig[islave].enable)
+	continue;
+
+      fprintf(fd, "%s\n    \"%s\": { \"arm\": \"%s\", \"slot\": %d, "
+	      "\"port\": %d, \"busy_fraction\": %.5f }",
+	      first ? "" : ",",
+	      tdSlaveConfig[islave].rocname,
+	      armNames[tdSlaveConfig[islave].arm],
+	      tdSlaveConfig[islave].slot, tdSlaveConfig[islave].port,
+	      rocBusyFraction[islave]);
+      first = 0;
+    }
+  fprintf(fd, "%s}\n", first ? "" : "\n  ");
+  fprintf(fd, "}\n");
+
+  fclose(fd);
+  printf("%s: Run report written to %s\n", __func__, path);
+}
+
+/* Copy nwords registers from base, in one pass under the VME bus lock */
+void
+statusReadRegs(volatile unsigned int *base, unsigned int *copy, int nwords)
+{
+  int iword;
+
+  if(base == NULL)
+    {
+      memset(copy, 0, nwords * sizeof(unsigned int));
+      return;
+    }
+
+  vmeBusLock();
+  for(iword = 0; iword < nwords; iword++)
+    copy[iword] = vmeRead32(&base[iword]);
+  vmeBusUnlock();
+}
+
+void
+statusPrintRegs(char *name, unsigned int *regs)
+{
+  int iword;
+
+  printf("  %s registers:", name);
+  for(iword = 0; iword < STATUS_REG_WORDS; iword++)
+    {
+      if((iword % 8) == 0)
+	printf("\n    0x%03x:", 4*iword);
+      printf(" %08x", regs[iword]);
+    }
+  printf("\n");
+}
+
+void *
+statusRun(void *arg)
+{
+  STATUS_SNAPSHOT *snap = &statusSnap;
+  char name[16];
+  int ii, iport;
+
+  DALMAGO;
+  printf("%s status: blocks = %d  bready = %d  TS busy = 0x%08x  "
+	 "block level = %d\n",
+	 snap->transition, snap->blocks, snap->bready, snap->tsBusy,
+	 snap->blockLevel);
+  for(ii = 0; ii < nTD; ii++)
+    {
+      printf("  TD %2d  link 0x%02x  trigsrc 0x%02x",
+	     snap->td[ii].slot, snap->td[ii].linkMask,
+	     snap->td[ii].trigSrcMask);
+      if(snap->busyCounters)
+	{
+	  printf("  busy");
+	  for(iport = 0; iport < TD_NPORTS; iport++)
+	    printf(" %u", snap->td[ii].busy[iport]);
+	}
+      printf("\n");
+    }
+
+  if(snap->level >= STATUS_FULL)
+    {
+      statusPrintRegs("TS", snap->tsRegs);
+      for(ii = 0; ii < nTD; ii++)
+	{
+	  snprintf(name, sizeof(name), "TD %d", snap->td[ii].slot);
+	  statusPrintRegs(name, snap->tdRegs[ii]);
+	}
+    }
+  DALMASTOP;
+
+  return NULL;
+}
+
+/* Wait for the previous status dump to finish */
+void
+statusWait()
+{
+  if(statusThreadActive)
+    {
+      pthread_join(statusThread, NULL);
+      statusThreadActive = 0;
+    }
+}
+
+/*
+  Dump the status for 'transition' on the status thread.  The snapshot
+  is read here, so it reflects the state at the call.  regs = 0 leaves
+  out the register copies.
+*/
+void
+statusDump(char *transition, int busyCounters, int regs)
+{
+  int ii;
+
+  statusWait();
+
+  if(statusLevel == STATUS_NONE)
+    return;
+
+  memset(&statusSnap, 0, sizeof(statusSnap));
+  statusSnap.transition = transition;
+  statusSnap.level = (!regs && (statusLevel > STATUS_COMPACT)) ?
+    STATUS_COMPACT : statusLevel;
+  statusSnap.busyCounters = busyCounters;
+
+  statusSnap.blocks = tsGetIntCount();
+  statusSnap.bready = tsBReady();
+  statusSnap.tsBusy = tsGetBusyStatus(0);
+  statusSnap.blockLevel = blockLevel;
+  watchdogReadTD(statusSnap.td);
+
+  if(statusSnap.level >= STATUS_FULL)
+    {
+      statusReadRegs((volatile unsigned int *)TSp, statusSnap.tsRegs,
+		     STATUS_REG_WORDS);
+      for(ii = 0; ii < nTD; ii++)
+	statusReadRegs((volatile unsigned int *)TDp[tdID[ii]],
+		       statusSnap.tdRegs[ii], STATUS_REG_WORDS);
+    }
+
+  if(pthread_create(&statusThread, NULL, statusRun, NULL) != 0)
+    {
+      printf("%s: ERROR creating status thread\n", __func__);
+      return;
+    }
+  statusThreadActive = 1;
+}
+
+int
+slotCacheRead(SLOT_CACHE *c)
+{
+  char key[16];
+  unsigned int a, b;
+  FILE *fd;
+
+  memset(c, 0, sizeof(SLOT_CACHE));
+
+  fd = fopen(SLOT_CACHE_FILE, "r");
+  if(fd == NULL)
+    return -1;
+
+  while(fscanf(fd, "%15s %u %x", key, &a, &b) == 3)
+    {
+      if(strcmp(key, "pending") == 0)
+	c->pending = a;
+      else if(strcmp(key, "ts") == 0)
+	{
+	  c->tsSlot = a;
+	  c->tsFirmware = b;
+	}
+      else if(strcmp(key, "sd") == 0)
+	c->sdFirmware = b;
+      else if((strcmp(key, "td") == 0) && (c->nTD < 21))
+	{
+	  c->tdSlot[c->nTD] = a;
+	  c->tdFirmware[c->nTD] = b;
+	  c->nTD++;
+	}
+    }
+  fclose(fd);
+
+  return 0;
+}
+
+int
+slotCacheWrite(SLOT_CACHE *c)
+{
+  FILE *fd;
+  int ii;
+
+  fd = fopen(SLOT_CACHE_FILE, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, SLOT_CACHE_FILE);
+      return -1;
+    }
+
+  fprintf(fd, "pending %d 0\n", c->pending);
+  fprintf(fd, "ts %d 0x%x\n", c->tsSlot, c->tsFirmware);
+  fprintf(fd, "sd 0 0x%x\n", c->sdFirmware);
+  for(ii = 0; ii < c->nTD; ii++)
+    fprintf(fd, "td %d 0x%x\n", c->tdSlot[ii], c->tdFirmware[ii]);
+  fclose(fd);
+
+  return 0;
+}
+
+/* Remex function to force a full VME scan at the next Download */
+void
+slotCacheClear()
+{
+  remove(SLOT_CACHE_FILE);
+  slotCacheValid = 0;
+}
+
+/*
+  TS_ADDR for tsInit, before rocDownload.  The cache is marked pending
+  until rocDownload confirms it, so a Download that fails at the cached
+  address goes back to the full scan the next time.
+*/
+unsigned int
+slotCacheTSAddr()
+{
+  slotCacheValid = 0;
+
+  if(slotCacheRead(&slotCache) != 0)
+    return 0;
+
+  if(slotCache.pending || (slotCache.tsSlot <= 0))
+    {
+      printf("%s: Previous Download with the slot cache failed, full scan\n",
+	     __func__);
+      return 0;
+    }
+
+  slotCacheValid = 1;
+  slotCache.pending = 1;
+  slotCacheWrite(&slotCache);
+
+  return slotCache.tsSlot << 19;
+}
+
+/*
+  Initialize the TDs, at the cached slots if they are contiguous,
+  otherwise (or if the cached TDs are not all there) with the full scan.
+*/
+void
+slotCacheTDInit()
+{
+  int ii, contiguous = 1;
+
+  if(slotCacheValid && (slotCache.nTD > 0))
+    {
+      for(ii = 1; ii < slotCache.nTD; ii++)
+	if(slotCache.tdSlot[ii] != slotCache.tdSlot[0] + ii)
+	  contiguous = 0;
+
+      if(contiguous)
+	{
+	  tdInit(slotCache.tdSlot[0] << 19, 1 << 19, slotCache.nTD, 0);
+	  if(nTD == slotCache.nTD)
+	    return;
+
+	  daLogMsg("WARN","Found %d of %d cached TDs, doing a full scan",
+		   nTD, slotCache.nTD);
+	}
+    }
+
+  tdInit(0,0,0,0);
+}
+
+/*
+  After the boards are initialized, compare with the cache, report any
+  difference, and save what was found.
+*/
+void
+slotCacheUpdate()
+{
+  SLOT_CACHE found;
+  int ii;
+
+  memset(&found, 0, sizeof(found));
+  found.tsSlot = tsGetGeoAddress();
+  found.tsFirmware = tsGetFirmwareVersion();
+  found.sdFirmware = sdGetFirmwareVersion(0);
+  found.nTD = nTD;
+  for(ii = 0; ii < nTD; ii++)
+    {
+      found.tdSlot[ii] = tdID[ii];
+      found.tdFirmware[ii] = tdGetFirmwareVersion(tdID[ii]);
+    }
+
+  if(slotCacheValid)
+    {
+      if(found.tsFirmware != slotCache.tsFirmware)
+	daLogMsg("WARN","TS firmware changed 0x%x -> 0x%x",
+		 slotCache.tsFirmware, found.tsFirmware);
+      if(found.sdFirmware != slotCache.sdFirmware)
+	daLogMsg("WARN","SD firmware changed 0x%x -> 0x%x",
+		 slotCache.sdFirmware, found.sdFirmware);
+      if(found.nTD != slotCache.nTD)
+	daLogMsg("WARN","Number of TDs changed %d -> %d",
+		 slotCache.nTD, found.nTD);
+      for(ii = 0; (ii < found.nTD) && (ii < slotCache.nTD); ii++)
+	{
+	  if(found.tdSlot[ii] != slotCache.tdSlot[ii])
+	    daLogMsg("WARN","TD %d moved from slot %d to slot %d",
+		     ii, slotCache.tdSlot[ii], found.tdSlot[ii]);
+	  else if(found.tdFirmware[ii] != slotCache.tdFirmware[ii])
+	    daLogMsg("WARN","TD slot %d firmware changed 0x%x -> 0x%x",
+		     found.tdSlot[ii], slotCache.tdFirmware[ii],
+		     found.tdFirmware[ii]);
+	}
+    }
+
+  slotCache = found;
+  slotCache.pending = 0;
+  slotCacheWrite(&slotCache);
+}
+
+int
+warmDownloadRead(int *pending, unsigned int *fingerprint)
+{
+  FILE *fd;
+  int ok;
+
+  fd = fopen(WARM_DOWNLOAD_FILE, "r");
+  if(fd == NULL)
+    return -1;
+
+  ok = (fscanf(fd, "pending %d fingerprint %x", pending, fingerprint) == 2);
+  fclose(fd);
+
+  return ok ? 0 : -1;
+}
+
+int
+warmDownloadWrite(int pending, unsigned int fingerprint)
+{
+  FILE *fd;
+
+  fd = fopen(WARM_DOWNLOAD_FILE, "w");
+  if(fd == NULL)
+    {
+      printf("%s: ERROR opening %s\n", __func__, WARM_DOWNLOAD_FILE);
+      return -1;
+    }
+
+  fprintf(fd, "pending %d\nfingerprint 0x%08x\n", pending, fingerprint);
+  fclose(fd);
+
+  return 0;
+}
+
+/* FNV-1a over what a full Download configures and Prestart leaves alone */
+unsigned int
+warmFingerprint()
+{
+  unsigned int hash = 2166136261u, word[16 + 8*21];
+  unsigned int regs[WARM_REG_WORDS];
+  unsigned char *byte = (unsigned char *)word;
+  char *build = DAYTIME;
+  int nword = 0, ii, rule;
+
+  while(*build)
+    hash = (hash ^ (unsigned char)*build++) * 16777619u;
+
+  word[nword++] = rocTriggerSource;
+  word[nword++] = TS_READOUT;
+  word[nword++] = blockLevel;
+  word[nword++] = bufferLevel;
+
+  word[nword++] = tsGetFirmwareVersion();
+  word[nword++] = tsGetGeoAddress();
+  for(rule = 2; rule <= 4; rule++)
+    word[nword++] = tsGetTriggerHoldoff(rule);
+  statusReadRegs((volatile unsigned int *)TSp, regs, WARM_REG_WORDS);
+  word[nword++] = regs[WARM_REG_FORMAT];
+  word[nword++] = regs[WARM_REG_SYNC];
+  word[nword++] = regs[WARM_REG_CLOCK];
+
+  word[nword++] = sdGetFirmwareVersion(0);
+  word[nword++] = sdGetActiveVmeSlots();
+  for(ii = 0; ii < nTD; ii++)
+    {
+      word[nword++] = tdID[ii];
+      word[nword++] = tdGetFirmwareVersion(tdID[ii]);
+      word[nword++] = tdGetConnectedFiberMask(tdID[ii]);
+      statusReadRegs((volatile unsigned int *)TDp[tdID[ii]], regs, WARM_REG_WORDS);
+      word[nword++] = regs[WARM_REG_FIBER];
+      word[nword++] = regs[WARM_REG_FORMAT];
+      word[nword++] = regs[WARM_REG_TRIGSRC];
+      word[nword++] = regs[WARM_REG_SYNC];
+      word[nword++] = regs[WARM_REG_CLOCK];
     }
 
-  /* enable 'BIGBITE', 'BIGBITE=1'
-     disable 'BIGBITE=0'
-     similar for 'LHRS' and 'HCAL'
-  */
-  int iarm=0;
-  for(iarm = 0; iarm < nArms; iarm++)
-    {
-      flagval = 0;
-      flag = getflag(armNames[iarm]);
+  for(ii = 0; ii < nword * (int)sizeof(word[0]); ii++)
+    hash = (hash ^ byte[ii]) * 16777619u;
 
-      if(flag)
-	{
-	  flagval = 1;
+  return hash;
+}
 
-	  if(flag > 1)
-	    flagval = getint(armNames[iarm]);
+/*
+  TS_FLAG for tsInit, before rocDownload.  Only maps the TS if the last
+  Download finished and left a fingerprint.  The file is marked pending
+  until this Download finishes.
+*/
+int
+warmDownloadTSFlag()
+{
+  int pending = 1;
 
-	  for(i = 0; i < nSlaves; i++)
-	    {
-	      if(tdSlaveConfig[i].arm == iarm)
-		tdSlaveConfig[i].enable = flagval;
-	    }
-	}
-    }
+  warmDownload = 0;
 
-  /* enable 'bbshowerROC6', 'bbshowerROC6=1'
-     disable 'bbshowerROC6=0'
-     similar for the rest of the crates
-  */
-  int islave=0;
-  for(islave = 0; islave < nSlaves; islave++)
-    {
-      flagval = 0;
-      flag = getflag(tdSlaveConfig[islave].rocname);
+  if(warmForce || warmDisable)
+    return 0;
 
-      if(flag)
-	{
-	  flagval = 1;
+#ifdef FAULT_INJECT
+  if(faultMask & (1 << FAULT_TD_MISSING))
+    return 0;  /* the fault is injected by the full TD init */
+#endif
 
-	  if(flag > 1)
-	    flagval = getint(tdSlaveConfig[islave].rocname);
+  if((warmDownloadRead(&pending, &warmSaved) != 0) || pending)
+    return 0;
 
-	  tdSlaveConfig[islave].enable = flagval;
-	}
+  warmDownloadWrite(1, warmSaved);
+  warmDownload = 1;
 
-    }
+  return TS_INIT_NO_INIT;
+}
 
-  /* Print config */
-  printf("%s\n TD Slave Config from usrstringutils\n",
-	 __func__);
-  printf("  Enable      Slot      Port       Arm       Roc\n");
-  printf("|----------------------------------------------------------|\n");
+/*
+  Map the TDs and SD without initializing them and compare the
+  fingerprint.  If it is not a match, initialize the TS after all and
+  return 0 for the full Download.
+*/
+int
+warmDownloadCheck()
+{
+  char *reason = NULL;
+  int ii;
 
-  for(islave = 0; islave < nSlaves; islave++)
+  if(!warmDownload)
     {
-      printf("       %d  ",
-	     tdSlaveConfig[islave].enable);
+      if(warmForce || warmDisable)
+	daLogMsg("INFO","Full Download (%s)",
+		 warmForce ? "forced" : "fulldownload");
+      warmForce = 0;
+      return 0;
+    }
 
-      printf("      %2d ",
-	     tdSlaveConfig[islave].slot);
+  warmDownload = 0;
 
-      printf("       %d  ",
-	     tdSlaveConfig[islave].port);
+  if(!slotCacheValid || (slotCache.nTD == 0))
+    reason = "no VME slot cache";
 
-      printf(" %-10s",
-	     armNames[tdSlaveConfig[islave].arm]);
+  for(ii = 1; (reason == NULL) && (ii < slotCache.nTD); ii++)
+    if(slotCache.tdSlot[ii] != slotCache.tdSlot[0] + ii)
+      reason = "TD slots not contiguous";
 
-      printf(" %-20s",
-	     tdSlaveConfig[islave].rocname);
+  if(reason == NULL)
+    {
+      tdInit(slotCache.tdSlot[0] << 19, 1 << 19, slotCache.nTD, TD_INIT_NO_INIT);
+      if(nTD != slotCache.nTD)
+	reason = "TDs missing";
+    }
 
-      printf("\n");
+  if(reason == NULL)
+    {
+      sdInit(SD_INIT_NO_INIT);
+      if(warmFingerprint() != warmSaved)
+	reason = "configuration read back changed";
     }
 
-  printf("\n");
+  if(reason)
+    {
+      daLogMsg("INFO","Full Download: %s", reason);
+      tsInit(tsGetGeoAddress() << 19, TS_READOUT, 0);
+      return 0;
+    }
+
+  warmDownload = 1;
+  daLogMsg("INFO","Warm Download: hardware configuration unchanged");
+
+  return 1;
+}
+
+/* Remex function to force a full Download next time */
+void
+downloadForceFull()
+{
+  warmForce = 1;
+}
 
+/* Close the transition timing, print it and keep it for trending */
+void
+transitionTimingEnd()
+{
+  ttTransitionEnd();
+  ttWrite(TT_TREND_FILE, ttFolded ? TT_FOLDED_FILE : NULL);
+  if(ttNsteps > 0)
+    cycleTrackTransition(ttSteps[0].ms);
 }
 
 #ifdef SCALERS
@@ -339,6 +3070,168 @@ void setScalerInhibit(int inhibit) {
 }
 #endif
 
+/* Apply a prescale change from the control socket, from block evntno on */
+void
+controlPrescaleApply(int evntno)
+{
+  int input;
+
+  /* Someone else is applying changes, try again later */
+  if(!prescaleApplyTake())
+    return;
+
+  input = __atomic_load_n(&controlPrescaleInput, __ATOMIC_ACQUIRE);
+  if(input >= 0)
+    {
+      __atomic_store_n(&controlPS[input], controlPrescaleValue, __ATOMIC_RELAXED);
+      tsSetTriggerPrescale(2, input, controlPrescaleValue);
+      prescaleRecord(evntno, input, controlPrescaleValue);
+      __atomic_store_n(&controlPrescaleInput, -1, __ATOMIC_RELEASE);
+    }
+
+  prescaleApplyGive();
+}
+
+/* Wait for rocTrigger to apply the control socket prescale, or apply it
+   from here once no block has come in for CONTROL_IDLE_US */
+void
+controlPrescaleWait()
+{
+  unsigned long long triggers = runTriggers;
+  int idle = 0;
+
+  while(__atomic_load_n(&controlPrescaleInput, __ATOMIC_ACQUIRE) >= 0)
+    {
+      usleep(10000);
+      if(runTriggers != triggers)
+	{
+	  /* Blocks are coming, make sure one of them takes it */
+	  triggers = runTriggers;
+	  idle = 0;
+	  tsTriggerWake();
+	  continue;
+	}
+
+      idle += 10000;
+      if(idle >= CONTROL_IDLE_US)
+	controlPrescaleApply(tsGetIntCount() + 1);
+    }
+}
+
+/* controlSocket.c hook: answer a request from tsControl */
+int
+controlHandle(CONTROL_REQUEST *req, void *data, uint32_t *nbytes)
+{
+  CONTROL_COUNTERS *c = data;
+  CONTROL_CONFIG *cfg = data;
+  CONTROL_COINCIDENCE *co = data;
+  uint32_t *w = data;
+  struct timespec now;
+  int jj;
+
+  switch(req->cmd)
+    {
+    case CONTROL_CMD_PING:
+      w[0] = CONTROL_VERSION;
+      w[1] = rol->runNumber;
+      *nbytes = 2*sizeof(uint32_t);
+      break;
+
+    case CONTROL_CMD_COUNTERS:
+      memset(c, 0, sizeof(*c));
+      c->run = rol->runNumber;
+      c->active = TSPRIMARYflag;
+      c->triggers = runTriggers;
+      c->blocks = tsGetIntCount();
+      c->syncCheckErrors = syncCheckErrors;
+      if(TSPRIMARYflag)
+	{
+	  clock_gettime(CLOCK_MONOTONIC, &now);
+	  c->seconds = timeDiff(&runGoTime, &now);
+	}
+      c->peakRate = peakTrigRate;
+      c->latency50 = latencyPercentile(0.5);
+      c->latency99 = latencyPercentile(0.99);
+      *nbytes = sizeof(*c);
+      break;
+
+    case CONTROL_CMD_LATENCY:
+      w[0] = LATENCY_BIN_NS;
+      w[1] = LATENCY_NBINS + 1;
+      memcpy(&w[2], readoutLatency, sizeof(readoutLatency));
+      *nbytes = 2*sizeof(uint32_t) + sizeof(readoutLatency);
+      break;
+
+    case CONTROL_CMD_CONFIG:
+      memset(cfg, 0, sizeof(*cfg));
+      cfg->blockLevel = blockLevel;
+      cfg->bufferLevel = bufferLevel;
+      cfg->triggerSource = rocTriggerSource;
+#ifdef SCALERS
+      cfg->scalerInhibit = scaler_inhibit;
+#endif
+      for(jj = 0; jj < NPSF; jj++)
+	cfg->prescale[jj] = (fpEnableMask & (1 << jj)) ? prescaleInUse[jj] : -1;
+      cfg->fpEnable = fpEnableMask;
+      cfg->fpMasked = rateCtlMasked;
+      cfg->rateTarget = rateCtlTarget;
+      cfg->nTD = nTD;
+      *nbytes = sizeof(*cfg);
+      break;
+
+    case CONTROL_CMD_COINCIDENCE:
+      if(!coincEnable)
+	return CONTROL_EREFUSED;
+      co->events = coincEvents;
+      co->other = coincOther;
+      coincidenceMatrix(co->matrix);
+      memcpy(co->patterns, coincPatterns, sizeof(co->patterns));
+      *nbytes = sizeof(*co);
+      break;
+
+    case CONTROL_CMD_SCALER_INHIBIT:
+#ifdef SCALERS
+      setScalerInhibit(req->arg[0]);
+      break;
+#else
+      return CONTROL_EREFUSED;
+#endif
+
+    case CONTROL_CMD_TRIGGER_SOURCE:
+      if((req->arg[0] < 0) || (req->arg[0] > 4))
+	return CONTROL_EARG;       /* see rocTriggerSource */
+      if(TSPRIMARYflag == 1)
+	return CONTROL_EREFUSED;
+      rocSetTriggerSource(req->arg[0]);
+      break;
+
+    case CONTROL_CMD_PRESCALE:
+      if((req->arg[0] < 1) || (req->arg[0] > NPSF) ||
+	 (req->arg[1] < 0) || (req->arg[1] > RATECTL_MAXPS))
+	return CONTROL_EARG;
+      if(controlPrescaleInput >= 0)
+	return CONTROL_EREFUSED;   /* another one is being applied */
+
+      daLogMsg("INFO","Control socket: T%d prescale %d -> %d",
+	       req->arg[0], prescaleInUse[req->arg[0] - 1], req->arg[1]);
+      controlPrescaleValue = req->arg[1];
+      __atomic_store_n(&controlPrescaleInput, req->arg[0] - 1, __ATOMIC_RELEASE);
+      if(TSPRIMARYflag != 1)
+	controlPrescaleApply(tsGetIntCount() + 1);    /* no blocks coming */
+      else
+	{
+	  tsTriggerWake();
+	  controlPrescaleWait();
+	}
+      break;
+
+    default:
+      return CONTROL_EUNKNOWN;
+    }
+
+  return CONTROL_OK;
+}
+
 /* function prototype */
 void rocTrigger(int arg);
 
@@ -349,6 +3242,11 @@ void
 rocDownload()
 {
 
+  ttTransitionBegin("Download");
+
+  /* Don't touch the hardware under a status dump still running */
+  statusWait();
+
   /* Setup Address and data modes for DMA transfers
    *
    *  vmeDmaConfig(addrType, dataType, sstMode);
@@ -357,16 +3255,28 @@ rocDownload()
    *  dataType = 0 (D16)    1 (D32)    2 (BLK32) 3 (MBLK) 4 (2eVME) 5 (2eSST)
    *  sstMode  = 0 (SST160) 1 (SST267) 2 (SST320)
    */
+  ttBegin("vmeDmaConfig");
   vmeDmaConfig(2,5,1);
+  ttEnd();
 
   /* Define BLock Level */
   blockLevel = BLOCKLEVEL;
   bufferLevel = BUFFERLEVEL;
 
+  /* Back to the prescales of prescale.dat */
+  memset(controlPS, -1, sizeof(controlPS));
+
+  /* Skip the board initialization if nothing changed since the last
+     full Download */
+  ttBegin("warmCheck");
+  warmDownloadCheck();
+  ttEnd();
+
 
   /*****************
    *   TS SETUP
    *****************/
+  ttBegin("tsSetup");
 
   if(rocTriggerSource == 0)
     {
@@ -394,7 +3304,12 @@ rocDownload()
   tsSetFPInputReadout(1);
 
   /* Load the default trigger table */
-  tsLoadTriggerTable();
+  if(!warmDownload)
+    {
+      ttBegin("tsLoadTriggerTable");
+      tsLoadTriggerTable();
+      ttEnd();
+    }
 
   /*
    * Trigger Holdoff rules:
@@ -419,24 +3334,54 @@ rocDownload()
 
   /* Set a Maximum Block count before trigger autmatically disables  (0 disables block limit)*/
   tsSetBlockLimit(0);
+  ttEnd();
 
   /* Override the busy source set in tsInit (only if TS crate running alone) */
 
- /* Setup TDs - */
-  tdInit(0,0,0,0);
+ /* Setup TDs - (mapped by warmDownloadCheck for a warm Download) */
+  if(!warmDownload)
+    {
+      ttBegin("tdInit");
+      slotCacheTDInit();
+      FAULT_TD_INIT();
+      ttEnd();
+    }
   // 30sept2021 8pm: Turn off bufferlevel on TDs
   tdGSetBlockBufferLevel(0);
   /* Reset Active ROC Masks on all TD modules */
+  ttBegin("tdTriggerReadyReset");
   int islot;
   for (islot = 0; islot < nTD; islot++)
     {
       tdTriggerReadyReset(tdSlot(islot));
     }
+  ttEnd();
+
+  if(!warmDownload)
+    {
+      /* Init SD Board. and set the initialzed TD Slots */
+      ttBegin("sdInit");
+      sdInit(0);
+      sdSetActiveVmeSlots(tdSlotMask());
+      ttEnd();
+      ttBegin("sdStatus");
+      sdStatus(0);
+      ttEnd();
+
+      /* Save the VME layout for the next Download */
+      ttBegin("slotCache");
+      slotCacheUpdate();
+      ttEnd();
+    }
+  else
+    {
+      /* Layout checked by the fingerprint, confirm the cache */
+      slotCache.pending = 0;
+      slotCacheWrite(&slotCache);
+    }
 
-  /* Init SD Board. and set the initialzed TD Slots */
-  sdInit(0);
-  sdSetActiveVmeSlots(tdSlotMask());
-  sdStatus(0);
+  /* Fingerprint for the next Download */
+  warmDownloadWrite(0, warmFingerprint());
 
 
 #ifdef SCALERS
@@ -444,10 +3389,14 @@ rocDownload()
   setScalerInhibit(0);
 #endif
 
+  tsTriggerSelect(TRIGGER_OUTPUT, 0, 0, 0);
+
 /*   tsSetPrescale(0); */
 
   printf("rocDownload: User Download Executed\n");
 
+  transitionTimingEnd();
+
 }
 
 /****************************************
@@ -461,43 +3410,100 @@ rocPrestart()
   int stat;
   int islot;
 
+  ttTransitionBegin("Prestart");
+
 #ifdef SCALERS
   /* Inhibit scalers */
   setScalerInhibit(1);
 #endif
 
-  /* Set number of events per block */
-  tsSetBlockLevel(blockLevel);
-  printf("rocPrestart: Block Level to be broadcasted: %d\n",blockLevel);
-  /* On TD's too */
-  tdGSetBlockLevel(blockLevel);
-
   /* Read User Flags with usrstringutils
      What's set
      - prescale factors
      - TD Slave Ports
      - bufferLevel
+     - autoblocklevel
    */
+  ttBegin("readUserFlags");
   readUserFlags();
+#ifdef FAULT_INJECT
+  faultInjectReset(faultFlagMask, faultFlagRate);
+#endif
+  ttEnd();
+
+  /* Check that the enabled slaves are alive */
+  ttBegin("fiberPreflight");
+  fiberPreflight();
+  ttEnd();
+
+  /* Pick the block level from the last run, if requested */
+  autoBlockLevelPrestart();
+
+  /* Open the trigger capture or replay file */
+  ttBegin("triggerCapture");
+  triggerCapturePrestart();
+  ttEnd();
+
+  ttBegin("rateSeries");
+  rateSeriesPrestart();
+  ttEnd();
+
+  ttBegin("crateModules");
+  crateModulesInit(crateModuleList);
+  ttEnd();
+
+  timestampCheckReset();
+  coincidenceReset();
+  runReportReset();
+  blockBudgetReset(1000 * blockBudgetUs);
+
+  /* Trigger path without the decoding hook, phase timing or work after
+     the block unless they're needed.  Prescale changes from the control
+     socket and the rate controller wake the post variant when they come */
+  tsTriggerSelect(TRIGGER_OUTPUT,
+		  (replayHeader != NULL) || (captureHeader != NULL) ||
+		  tsCheckEnable || coincEnable || (rateSeriesHeader != NULL),
+		  blockBudgetUs > 0,
+		  crateModuleCount > 0);
+
+  /* Set number of events per block */
+  ttBegin("blockLevel");
+  tsSetBlockLevel(blockLevel);
+  printf("rocPrestart: Block Level to be broadcasted: %d\n",blockLevel);
+  /* On TD's too */
+  tdGSetBlockLevel(blockLevel);
+  ttEnd();
+
+  /* Event types from the trigger rules, over the default table */
+  ttBegin("triggerTable");
+  tsLoadTriggerTable();
+  triggerTableLoad();
+  triggerTablePrint();
+  if(!trigRulesOK)
+    daLogMsg("ERROR","Trigger rules rejected, default trigger table loaded");
+  ttEnd();
 
   /* Reset Active ROC Masks on all TD modules */
+  ttBegin("tdTriggerReadyReset");
   for (islot = 0; islot < nTD; islot++)
     {
       tdTriggerReadyReset(tdSlot(islot));
     }
+  ttEnd();
 
   /* Set Sync Event Interval  (0 disables sync events, max 65535) */
   tsSetSyncEventInterval(ival);
   printf("rocPrestart: Set Sync interval to %d Blocks\n",ival);
 
   /* Print Status info */
-  DALMAGO;
-  tdGStatus(0);
-  tsStatus(0);
-  DALMASTOP;
+  ttBegin("status");
+  statusDump("Prestart", 0, 1);
+  ttEnd();
 
   printf("rocPrestart: User Prestart Executed\n");
 
+  transitionTimingEnd();
+
 }
 
 /****************************************
@@ -509,7 +3515,10 @@ rocGo()
 
   int ii, islot, tmask;
 
+  ttTransitionBegin("Go");
+
   /* Reset all TD slave configurations */
+  ttBegin("tdSlaveConfig");
   for (ii=0;ii<nTD;ii++) {
     tdResetSlaveConfig(tdID[ii]);
   }
@@ -537,14 +3546,17 @@ rocGo()
       }
 
     }
-
-  DALMAGO;
-  tdGStatus(0);
-  tsStatus(0);
-  DALMASTOP;
+  ttEnd();
 
   usrDebugFlag=0;
 
+  /* Status, before the pulser or triggers start */
+  ttBegin("status");
+  statusDump("Go", 0, 0);
+  ttEnd();
+
+  ttBegin("pulser");
+
 
   if(rocTriggerSource != 0)
     {
@@ -568,13 +3580,55 @@ rocGo()
 	  */
 	  tsSoftTrig(1,0xffff,100,0);
 	}
+
+      if(rocTriggerSource == 3)
+	{
+	  /* Random pulser, stepped through the holdoff sweep */
+	  sweepStart(holdoffCalSweep);
+	}
+
+      if(rocTriggerSource == 4)
+	{
+	  /* Random, then fixed rate, pulser schedule */
+	  nThroughputSweep = 0;
+	  sweepStart(throughputSweepRun);
+	}
     }
+  ttEnd();
 
 #ifdef SCALERS
   /* Enable scalers */
   setScalerInhibit(0);
 #endif
 
+  clock_gettime(CLOCK_MONOTONIC, &runGoTime);
+  lastSyncTime = runGoTime;
+  lastSyncTriggers = 0;
+  autoBlockLevelRequest = 0;
+  autoBlockLevelWaited = 0;
+  nBlockLevelHistory = 0;
+  nBlockLevelRequests = 0;
+  blockLevelRecord(1);
+
+  ttBegin("crateModules");
+  crateModulesArm();
+  ttEnd();
+
+  ttBegin("threads");
+  watchdogStart();
+  syncCheckStart();
+  rateCtlStart();
+  busyTraceStart(busyTraceUs);
+  if(rateSeriesHeader)
+    {
+      sweepReadBusy(rateSeriesBusy);
+      liveMark(&rateSeriesLive);
+      rateSeriesStart();
+    }
+  ttEnd();
+
+  transitionTimingEnd();
+
 }
 
 /****************************************
@@ -585,6 +3639,24 @@ rocEnd()
 {
 
   int islot;
+  char path[256];
+
+  ttTransitionBegin("End");
+
+  ttBegin("threads");
+  watchdogStop();
+  syncCheckStop();
+  rateCtlStop();
+  crateModulesEnd();
+
+  if(busyTraceRunning)
+    {
+      busyTraceStop();
+      busyTraceSave();
+    }
+
+  rateSeriesStop();
+  ttEnd();
 
 #ifdef SCALERS  /* Inhibit scalers */
   setScalerInhibit(1);
@@ -592,6 +3664,7 @@ rocEnd()
 #endif
 
 
+  ttBegin("pulser");
   if(rocTriggerSource == 1)
     {
       /* Disable random trigger */
@@ -604,82 +3677,197 @@ rocEnd()
       tsSoftTrig(1,0,100,0);
     }
 
+  if(rocTriggerSource == 3)
+    {
+      /* Stop the holdoff sweep, then the random trigger */
+      sweepStop();
+      tsDisableRandomTrigger();
+    }
+
+  if(rocTriggerSource == 4)
+    {
+      /* Stop the sweep, it leaves the pulsers disabled */
+      sweepStop();
+      throughputSweepWrite();
+    }
+  ttEnd();
+
+  ttBegin("tdLatchTimers");
   for (islot = 0; islot < nTD; islot++)
     {
       tdLatchTimers(tdSlot(islot));
     }
 
-  DALMAGO;
-  tdGPrintBusyCounters();
-  tdGStatus(0);
-  tsStatus(0);
-  DALMASTOP;
+  autoBlockLevelMeasure();
+  ttEnd();
+
+  ttBegin("reports");
+  triggerCaptureClose();
+  triggerReplayClose();
+
+  runReportWrite();
+
+  if(tsCheckEnable)
+    {
+      snprintf(path, sizeof(path), TSCHECK_FILE, rol->runNumber);
+      timestampCheckWrite(path);
+    }
+
+  if(coincEnable)
+    {
+      snprintf(path, sizeof(path), COINC_FILE, rol->runNumber);
+      coincidenceWrite(path);
+    }
+
+#ifdef FAULT_INJECT
+  if(faultMask)
+    {
+      snprintf(path, sizeof(path), FAULT_FILE, rol->runNumber);
+      faultInjectWrite(path);
+      faultInjectPrint();
+    }
+#endif
+
+  if(blockBudgetUs > 0)
+    {
+      snprintf(path, sizeof(path), BLOCKBUDGET_FILE, rol->runNumber);
+      blockBudgetWrite(path);
+      printf("rocEnd: %u of %u blocks over the %d us budget\n",
+	     blockBudgetOverruns(),
+	     budgetBlocks[0] + budgetBlocks[1], blockBudgetUs);
+    }
+  ttEnd();
+
+  ttBegin("status");
+  statusDump("End", 1, 1);
+  ttEnd();
 
   printf("rocEnd: Ended after %d blocks\n",tsGetIntCount());
 
+  transitionTimingEnd();
+  cycleTrackEnd(CYCLE_FILE);
+
 }
 
 /****************************************
  *  TRIGGER
  ****************************************/
+/* Replay, capture, timestamp check and input counts of each trigger block */
+int
+rocTriggerDecode(volatile unsigned int *data, int nwords, int evntno, int *sync)
+{
+  int rwords;
+
+  if(replayHeader)
+    {
+      /* The trigger block is the first bank of the event */
+      rwords = triggerReplayRead(data, MAX_EVENT_LENGTH/4 - MAX_WORDS, sync);
+      if(rwords > 0)
+	nwords = rwords;
+      else
+	{
+	  daLogMsg("ERROR","Trigger replay stopped at block %d: bad record",
+		   evntno);
+	  triggerReplayClose();
+	}
+    }
+
+  if(captureHeader)
+    triggerCaptureBlock(data, nwords, evntno, *sync);
+
+  if(tsCheckEnable)
+    timestampCheckBlock(data, nwords);
+
+  if(coincEnable)
+    coincidenceBlock(data, nwords);
+
+  if(rateSeriesHeader)
+    rateSeriesBlock(data, nwords);
+
+  return nwords;
+}
+
 void
-rocTrigger(int evntno)
+rocTriggerSync(int evntno)
 {
-  int ii, islot;
-  int stat, dCnt, len=0, idata;
-  int timeout;
+  syncRateUpdate();
+  blockLevelRecord(evntno + 1);
+
+  /* For the sync check thread and the block level controller */
+  if(syncCheckRunning)
+    {
+      syncCheckLatchCounters(evntno);
+      autoBlockLevelSync(evntno);
+    }
 
+  if(tsCheckEnable)
+    printf("rocTrigger: Timestamps: %u events, %u glitches, %u wraps\n",
+	   tsCheckEvents, tsCheckGlitches, tsCheckWraps);
 
-  /* Check if this is a Sync Event */
-  stat = tsGetSyncEventFlag();
-  if(stat) {
-    printf("rocTrigger: Got Sync Event!! Block # = %d\n",evntno);
-    usrDebugFlag=0;
-  }
+  /* Clear/Update Modules here */
+}
 
-  /* Set Output port bit 0  */
-#ifdef SCALERS
-  tsSetOutputPort(0,0,scaler_inhibit,scaler_inhibit,0,0);
-#else
-  tsSetOutputPort(1,0,0,0,0,0);
-#endif
+/*
+  Work between blocks, from the post variants of the trigger path.
+  Each part is charged to its own phase of the readout budget.
+*/
+void
+rocTriggerPost(int evntno, volatile unsigned int *block, int timed)
+{
+  if(timed)
+    tsTriggerPhaseMark(TRIGGER_PHASE_POST);
 
-  /* Readout the trigger block from the TS
-     Trigger Block MUST be reaodut first */
-  dCnt = tsReadTriggerBlock(dma_dabufp);
-  if(dCnt<=0)
+  /* Extra modules in the crate, after the trigger block, in the room
+     left by the event and the rate controller bank */
+  if(crateModuleCount)
     {
-      logMsg("No data or error.  dCnt = %d\n",dCnt);
+      crateModulesReadout((int)(block + MAX_EVENT_LENGTH/4 - dma_dabufp)
+			  - RATECTL_BANK_MAXWORDS);
+      if(timed)
+	tsTriggerPhaseMark(TRIGGER_PHASE_MODULES);
     }
-  else
-    { /* TS Data is already in a bank structure.  Bump the pointer */
-#ifdef DEBUGSYNCEVENT
-      if(stat) {
-	printf("rocTrigger: Sync Event data: 0x%08x 0x%08x 0x%08x 0x%08x\n",
-	       *dma_dabufp, *(dma_dabufp+1), *(dma_dabufp+2), *(dma_dabufp+3));
-      }
-#endif
-      dma_dabufp += dCnt;
+
+  /* Prescale change from the control socket */
+  if(controlPrescaleInput >= 0)
+    {
+      controlPrescaleApply(evntno + 1);
+      if(timed)
+	tsTriggerPhaseMark(TRIGGER_PHASE_CONTROL);
     }
 
-  if(stat) {
-    /* Set new block level if it has changed */
-    idata = tsGetCurrentBlockLevel();
-    if((idata != blockLevel)&&(idata<255)) {
-      blockLevel = idata;
-      printf("rocTrigger: Block Level changed to %d\n",blockLevel);
+  /* Rate controller changes since the last block */
+  if(__atomic_load_n(&rateCtlHead, __ATOMIC_ACQUIRE) != rateCtlTail)
+    {
+      rateCtlBank(evntno);
+      if(timed)
+	tsTriggerPhaseMark(TRIGGER_PHASE_RATECTL);
     }
+}
 
-    /* Clear/Update Modules here */
+/* Timed variants of the trigger path */
+void
+rocTriggerTimed(int evntno, unsigned int ns, volatile unsigned int *block,
+		int nwords)
+{
+  blockBudgetBlock(ns, evntno, block, nwords);
+}
 
-  }
+void
+rocTrigger(int evntno)
+{
+  struct timespec tStart, tEnd;
+  unsigned int ns, latbin;
 
-  /* Clear all output register bit 0 */
-#ifdef SCALERS
-  //  tsSetOutputPort(scaler_inhibit,scaler_inhibit,scaler_inhibit,scaler_inhibit,0,0);
-#else
-  tsSetOutputPort(0,0,0,0,0,0);
-#endif
+  clock_gettime(CLOCK_MONOTONIC, &tStart);
+
+  /* Variant selected at Prestart, see tsTrigger.c */
+  runTriggers += (*rocTriggerPath)(evntno);
+
+  clock_gettime(CLOCK_MONOTONIC, &tEnd);
+  ns = (tEnd.tv_sec - tStart.tv_sec)*1000000000 +
+    (tEnd.tv_nsec - tStart.tv_nsec);
+  latbin = ns / LATENCY_BIN_NS;
+  readoutLatency[(latbin < LATENCY_NBINS) ? latbin : LATENCY_NBINS]++;
 
 }
 
@@ -712,6 +3900,7 @@ void
 rocLoad()
 {
   dalmaInit(1);
+  controlOpen(CONTROL_SOCKET);
 }
 
 void
@@ -719,11 +3908,14 @@ rocCleanup()
 {
   int islot=0;
 
+  statusWait();
+
   /* Reset all TD slave configurations */
   for (islot=0;islot<nTD;islot++) {
     tdResetSlaveConfig(tdID[islot]);
   }
 
+  controlClose();
   dalmaClose();
 }
 
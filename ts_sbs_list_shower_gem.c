@@ -26,6 +26,9 @@
 extern int tdID[21];
 extern int nTD;
 
+/* Scaler inhibit bits of the output port (tsTrigger.c), not used here */
+int scaler_inhibit=0;
+
 #include "dmaBankTools.h"
 #include "tsprimary_list.c" /* source required for CODA */
 #include "sdLib.h"
@@ -61,6 +64,10 @@ void rocSetTriggerSource(int source); // routine prototype
 /* Global Flag for debug printing */
 int usrDebugFlag=0;
 
+/* Trigger path variants shared with the other TS lists */
+#define DEBUGSYNCEVENT
+#include "tsTrigger.c"
+
 
 /* function prototype */
 void rocTrigger(int arg);
@@ -157,6 +164,8 @@ rocDownload()
   /* Reset Active ROC Masks on all TD modules */
   tsTriggerReadyReset();
 
+  /* Output port bit 0 pulsed during readout */
+  tsTriggerSelect(TRIGGER_OUTPUT_PULSE, 0, 0, 0);
 
 /*   tsSetPrescale(0); */
 
@@ -288,56 +297,36 @@ rocEnd()
 /****************************************
  *  TRIGGER
  ****************************************/
-void
-rocTrigger(int evntno)
+/* No decoding of the trigger block in this list */
+int
+rocTriggerDecode(volatile unsigned int *data, int nwords, int evntno, int *sync)
 {
-  int ii, islot;
-  int stat, dCnt, len=0, idata;
-  int timeout;
-
-
-  /* Check if this is a Sync Event */
-  /*  stat = tsGetSyncEventFlag(); */
-  stat = syncFlag;
-  if(stat) {
-    printf("rocTrigger: Got Sync Event!! Block # = %d\n",evntno);
-    usrDebugFlag=0;
-  }
-
-  /* Set Output port bit 0  */
-  tsSetOutputPort(1,0,0,0,0,0);
-
-  /* Readout the trigger block from the TS
-     Trigger Block MUST be reaodut first */
-  dCnt = tsReadTriggerBlock(dma_dabufp);
-  if(dCnt<=0)
-    {
-      logMsg("No data or error.  dCnt = %d\n",dCnt);
-    }
-  else
-    { /* TS Data is already in a bank structure.  Bump the pointer */
-      if(stat) {
-	printf("rocTrigger: Sync Event data: 0x%08x 0x%08x 0x%08x 0x%08x\n",
-	       *dma_dabufp, *(dma_dabufp+1), *(dma_dabufp+2), *(dma_dabufp+3));
-      }
-      dma_dabufp += dCnt;
-    }
-
-  if(stat) {
-    /* Set new block level if it has changed */
-    idata = tsGetCurrentBlockLevel();
-    if((idata != blockLevel)&&(idata<255)) {
-      blockLevel = idata;
-      printf("rocTrigger: Block Level changed to %d\n",blockLevel);
-    }
+  return nwords;
+}
 
-    /* Clear/Update Modules here */
+void
+rocTriggerSync(int evntno)
+{
+  /* Clear/Update Modules here */
+}
 
-  }
+/* Not selected in this list */
+void
+rocTriggerPost(int evntno, volatile unsigned int *block, int timed)
+{
+}
 
-  /* Clear all output register bits */
-  tsSetOutputPort(0,0,0,0,0,0);
+void
+rocTriggerTimed(int evntno, unsigned int ns, volatile unsigned int *block,
+		int nwords)
+{
+}
 
+void
+rocTrigger(int evntno)
+{
+  /* Variant selected at Download, see tsTrigger.c */
+  (*rocTriggerPath)(evntno);
 }
 
 void
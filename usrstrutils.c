@@ -64,6 +64,7 @@
 
 char *internal_configusrstr="ffile=/adaqfs/home/sbs-onl/prescale/prescale.dat";
 char *file_configusrstr=0;
+size_t file_configusrsize=0;	/* allocated for file_configusrstr */
 
 /* For internal use. Returns ptr to keyword and ptr to value */
 void getflagpos(char *s,char **pos_ret,char **val_ret);
@@ -157,14 +158,16 @@ void getflagpos(char *s,char **pos_ret,char **val_ret)
 }
 
 void init_strings()
-     /* Load/reload config line from user flag file. */
+     /* Load/reload config line from user flag file.  The line is built in
+	one buffer that is kept, and only grown, across reloads. */
 {
   char *ffile_name;
   FILE *fd;
   char s[MAX_CONFIG_STRING];
-  char *confStr0;
+  char *grown;
   char confLn[MAX_CONFIG_STRING];
   int  il = 0;
+  size_t len = 0, arglen;
 
   if(!internal_configusrstr) {	/* Internal flags not loaded */
     internal_configusrstr = (char *) malloc(strlen(INTERNAL_FLAGS)+1);
@@ -175,21 +178,23 @@ void init_strings()
   printf("rcDatabase Conf: %s\n",rol->usrString);
 #endif
 
+  /* Looked up in the old line, before it is cleared */
   ffile_name = getstr(FLAG_FILE);
+
+  if(!file_configusrstr) {
+    file_configusrstr = (char *) malloc(MAX_CONFIG_STRING);
+    file_configusrsize = MAX_CONFIG_STRING;
+  }
+  file_configusrstr[0] = '\0';	/* Remove old line */
+
 /* check that filename exists */
-  fd = fopen(ffile_name,"r");
+  fd = ffile_name ? fopen(ffile_name,"r") : NULL;
   if(!fd) {
 #ifdef _USRSTRUTILS_DEBUG
     printf("Failed to open usr flag file %s\n",ffile_name);
 #endif
-    free(ffile_name);
-    if(file_configusrstr) free(file_configusrstr); /* Remove old line */
-    file_configusrstr = (char *) malloc(1);
-    file_configusrstr[0] = '\0';
   } else {
     /* Read till an uncommented line is found */
-    if(file_configusrstr) free(file_configusrstr); /* Remove old line */
-    file_configusrstr = 0;
     while(fgets(confLn,MAX_CONFIG_STRING-1,fd)){
       char *arg = confLn;
       /* Get rid of any whitespace */
@@ -206,26 +211,22 @@ void init_strings()
       if(arg) *arg = '\0'; /* Blow away comments */
       arg = s;
       /* Copy any remaining text to the config string */
-      if(strlen(arg)>0) {
-        if(!file_configusrstr) {
-          file_configusrstr = (char*)malloc(strlen(arg)+1);
-          strcpy(file_configusrstr,arg);
-        } else {
-          confStr0 = &(file_configusrstr[0]);
-          file_configusrstr = (char*)malloc(strlen(confStr0)+strlen(arg)+1);
-          strcpy(file_configusrstr,confStr0);
-          strcpy(&file_configusrstr[strlen(confStr0)],arg);
-          free(confStr0);
+      arglen = strlen(arg);
+      if(arglen>0) {
+        if(len+arglen+1 > file_configusrsize) {
+          grown = (char *) realloc(file_configusrstr,
+				   2*file_configusrsize + arglen);
+          if(!grown) break;	/* Keep what fits */
+          file_configusrstr = grown;
+          file_configusrsize = 2*file_configusrsize + arglen;
         }
+        strcpy(&file_configusrstr[len],arg);
+        len += arglen;
       }
     }
-    if(!file_configusrstr) {
-      file_configusrstr = (char *) malloc(1);
-      file_configusrstr[0] = '\0';
-    }
     fclose(fd);
-    free(ffile_name);
   }
+  if(ffile_name) free(ffile_name);
 #ifdef _USRSTRUTILS_DEBUG
   daLogMsg("Run time Config: %s\n",file_configusrstr);
 #endif